@@ -11,8 +11,27 @@
  */
 
 int syncFS(void);
+int journalCommit(void);
+int journalOperation(void);
+int metaRead(long block, char *buffer);
+int metaWrite(long block, char *buffer);
+int metadataTransfer(long first, long count, char *memory, int write);
+int metadataAlloc(void);
+void metadataFree(void);
+inode *iget(int i);
+void idirty(int i);
+inode *fileInode(int fileDescriptor);
 int ialloc(void);
-int balloc(void);
+long balloc(void);
+long balloc_n(int count);
 int namei(char *fileName);
 int ifree(int i);
-int bfree(int i);
\ No newline at end of file
+int bfree(int i);
+int bfreeRun(long b, long count);
+int readAheadFile(int fd, long start, long end);
+int nameHash(const char *name);
+int nameInsert(int i);
+int nameRemove(int i);
+int bmapFile(int fd, int first, int count, long *blocks);
+int extendFile(int fd, int count);
+int fileCrc(int fd, int verify, uint32_t *crc);
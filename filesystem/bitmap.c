@@ -0,0 +1,76 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	bitmap.c
+ * @brief 	Allocation bitmaps scanned a 64-bit word at a time.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#include "filesystem/bitmap.h"
+
+/*
+ * Returns the first bit equal to value in [from, to), or to if there is none.
+ * Whole words without it are skipped with a single test.
+ */
+static long next_bit(const uint64_t *map, long from, long to, int value) {
+	while(from < to) {
+		uint64_t w = value ? map[from >> 6] : ~map[from >> 6];
+		w &= ~0ULL << (from & 63);
+		if(w != 0) {
+			long i = (from & ~63L) + __builtin_ctzll(w);
+			return i < to ? i : to;
+		}
+		from = (from & ~63L) + 64;
+	}
+	return to;
+}
+
+/*
+ * Returns the first run of count clear bits that starts in [from, to) and
+ * ends before nbits, or -1.
+ */
+static long find_run(const uint64_t *map, long from, long to, long nbits, long count) {
+	long i = next_bit(map, from, to, 0);
+	while(i < to) {
+		//The run only has to be count long, so the scan stops there
+		long end = count < nbits - i ? i + count : nbits;
+		long j = next_bit(map, i, end, 1);
+		if(j - i >= count) return i;
+		i = next_bit(map, j, to, 0);
+	}
+	return -1;
+}
+
+void bitmap_setrun(uint64_t *map, long i, long count, int val) {
+	long end = i + count;
+	while(i < end) {
+		long n = 64 - (i & 63);
+		if(n > end - i) n = end - i;
+		uint64_t mask = (n == 64 ? ~0ULL : (1ULL << n) - 1) << (i & 63);
+		if(val) map[i >> 6] |= mask;
+		else map[i >> 6] &= ~mask;
+		i += n;
+	}
+}
+
+long bitmap_alloc(uint64_t *map, long nbits, long *hint) {
+	return bitmap_alloc_run(map, nbits, 1, hint);
+}
+
+long bitmap_alloc_run(uint64_t *map, long nbits, long count, long *hint) {
+	if(count <= 0 || count > nbits) return -1;
+	long h = *hint >= 0 && *hint < nbits ? *hint : 0;
+
+	//Next fit: from the hint to the end, then the runs starting before it
+	long i = find_run(map, h, nbits, nbits, count);
+	if(i < 0) i = find_run(map, 0, h, nbits, count);
+	if(i < 0) return -1;
+
+	bitmap_setrun(map, i, count, 1);
+	*hint = i + count;
+	return i;
+}
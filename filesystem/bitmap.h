@@ -0,0 +1,53 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	bitmap.h
+ * @brief 	Headers of the allocation bitmaps of inodes and blocks.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#include <stdint.h>
+
+#define BITMAP_WORDS(bits_) (((bits_) + 63) / 64) // 64-bit words holding a map of bits_ bits
+
+/*
+ * Returns the bit i of the map.
+ */
+static inline int bitmap_getbit(const uint64_t *map, long i) {
+	return (map[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+ * Sets the bit i of the map to val.
+ */
+static inline void bitmap_setbit(uint64_t *map, long i, int val) {
+	if(val) map[i >> 6] |= 1ULL << (i & 63);
+	else map[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+/*
+ * Sets count bits of the map to val, starting at bit i.
+ */
+void bitmap_setrun(uint64_t *map, long i, long count, int val);
+
+/*
+ * Finds a clear bit among the first nbits of the map, starting at *hint and
+ * wrapping around, sets it and leaves *hint just after it.
+ * Returns the bit or -1 if the map is full.
+ */
+long bitmap_alloc(uint64_t *map, long nbits, long *hint);
+
+/*
+ * Like bitmap_alloc, for a run of count consecutive clear bits.
+ * Returns the first bit of the run or -1 if there is none that long.
+ */
+long bitmap_alloc_run(uint64_t *map, long nbits, long count, long *hint);
+
+#endif
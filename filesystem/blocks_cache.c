@@ -1,4 +1,3 @@
-
 /*
  *
  * Operating System Design / Diseño de Sistemas Operativos
@@ -13,75 +12,1003 @@
 
 
 #include "filesystem/blocks_cache.h"
+#include "filesystem/blocks_uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
+#define DEVICE_NAME_LENGTH 256
+#define MAX_RUN_BLOCKS 64 // Blocks moved by a single vectored transfer
+#define RING_ENTRIES 64 // Requests in flight with the io_uring backend
 
-/****************/
-/* Disk access. */
-/****************/
+/*
+ * Device session: descriptor and length of the device opened by bopen,
+ * shared by every bread/bwrite until bclose.
+ */
+static struct {
+	int fd;
+	off_t length;
+	int refs;
+	char name[DEVICE_NAME_LENGTH];
+} device = { -1, 0, 0, "" };
 
 /*
- * Reads a block from the device and stores it in a buffer.
- * Returns 0 or -1 in case of error, including short
- * read.
+ * Block cache: a fixed number of block buffers of the session device, found
+ * through a hash of the block number and evicted in LRU order.
+ */
+typedef struct {
+	long block;	// Block held by the slot, -1 if free
+	int prev, next;	// LRU list, most recently used first
+	int hnext;	// Next slot in the same hash bucket
+	char dirty;	// Newer than the device, written back at the next flush
+	char pending;	// Being filled by a read request in flight
+	int pins;	// Borrowers of the slot, it is not evicted while pinned
+	char *data;
+} cache_slot;
+
+static struct {
+	int capacity;
+	int nbuckets;
+	cache_slot *slots;
+	int *buckets;
+	char *data;
+	int head, tail;
+	int dirtyLimit;	// Dirty slots that trigger a flush, 0 to write through
+	int ndirty;
+	unsigned long hits, misses;
+} cache = { 0 };
+
+/*
+ * A run of consecutive blocks handed to the backend. slots holds the cache
+ * slot behind each block, or -1 for a caller buffer.
+ */
+typedef struct {
+	int busy;
+	int write;
+	int count;
+	off_t offset;
+	struct iovec iov[MAX_RUN_BLOCKS];
+	int slots[MAX_RUN_BLOCKS];
+} block_request;
+
+static struct {
+	int backend;
+	block_request requests[RING_ENTRIES];
+	int inflight;	// Requests in flight
+	int writes;	// Write requests in flight
+	int failed;	// A caller request failed since the last bcomplete
+	char *map;	// Mapping of the whole device with the mmap backend
+	int mapDirty;	// The mapping was written since the last msync
+} io = { BLOCK_BACKEND_SYNC };
+
+
+/*
+ * Checks that the whole block fits inside a device of the given length.
+ * Returns the offset of the block or -1 if it is out of the device.
+ */
+static off_t block_offset(off_t length, long blockNumber) {
+	if(blockNumber < 0) return -1;
+	off_t offset = (off_t) BLOCK_SIZE * blockNumber;
+	if(offset + BLOCK_SIZE > length) return -1;
+	return offset;
+}
+
+/*
+ * Reads or writes a full block at the given offset, retrying short transfers.
+ * Returns 0 or -1 in case of error, including short read.
+ */
+static int block_transfer(int fd, off_t offset, char *buffer, int write) {
+	int total = 0, result;
+
+	while(total < BLOCK_SIZE) {
+		if(write) result = pwrite(fd, buffer+total, BLOCK_SIZE-total, offset+total);
+		else result = pread(fd, buffer+total, BLOCK_SIZE-total, offset+total);
+		if(result < 0 && errno == EINTR) continue;
+		if(result <= 0) return -1;
+		total = total + result;
+	}
+
+	return 0;
+}
+
+/*
+ * Reads or writes a run of consecutive blocks described by iov with a
+ * single vectored call, retrying short transfers. iov is consumed.
+ * Returns 0 or -1 in case of error.
+ */
+static int vector_transfer(int fd, off_t offset, struct iovec *iov, int iovcnt, int write) {
+	while(iovcnt > 0) {
+		ssize_t result;
+		if(write) result = pwritev(fd, iov, iovcnt, offset);
+		else result = preadv(fd, iov, iovcnt, offset);
+		if(result < 0 && errno == EINTR) continue;
+		if(result <= 0) return -1;
+
+		offset += result;
+		while(iovcnt > 0 && (size_t) result >= iov->iov_len) {
+			result -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->iov_base = (char *) iov->iov_base + result;
+			iov->iov_len -= result;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Orders the entries of a block list by block number, keeping the list
+ * order between entries of the same block.
+ */
+static block_io *sort_list;
+static int ring_reap(int wait);
+
+static int order_compare(const void *a, const void *b) {
+	int x = *(const int *) a, y = *(const int *) b;
+	if(sort_list[x].blockNumber != sort_list[y].blockNumber)
+		return sort_list[x].blockNumber < sort_list[y].blockNumber ? -1 : 1;
+	return x - y;
+}
+
+static void sort_order(block_io *blocks, int *order, int n) {
+	sort_list = blocks;
+	qsort(order, n, sizeof(int), order_compare);
+	sort_list = NULL;
+}
+
+/*
+ * Moves the entries of blocks listed in order, sorted by block number,
+ * with one vectored transfer per run of consecutive blocks.
+ * Returns 0 or -1 in case of error.
+ */
+static int runs_transfer(int fd, block_io *blocks, int *order, int n, int write) {
+	struct iovec iov[MAX_RUN_BLOCKS];
+
+	for(int i = 0; i < n; ) {
+		long first = blocks[order[i]].blockNumber;
+		int run = 0;
+		while(i + run < n && run < MAX_RUN_BLOCKS && blocks[order[i+run]].blockNumber == first + run) {
+			iov[run].iov_base = blocks[order[i+run]].buffer;
+			iov[run].iov_len = BLOCK_SIZE;
+			run++;
+		}
+		if(vector_transfer(fd, (off_t) BLOCK_SIZE * first, iov, run, write) != 0) return -1;
+		i += run;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns the descriptor of the open session if it belongs to deviceName,
+ * otherwise opens the device for a single transfer.
  */
-int bread(char *deviceName, int blockNumber, char *buffer) {
-	int fd = open(deviceName, O_RDONLY);
+static int device_acquire(char *deviceName, int flags, off_t *length) {
+	if(device.fd >= 0 && strcmp(device.name, deviceName) == 0) {
+		*length = device.length;
+		return device.fd;
+	}
 
+	int fd = open(deviceName, flags);
 	if(fd < 0){
 		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
 		close(fd);
 		return -1;
 	}
+	*length = st.st_size;
+	return fd;
+}
+
+static void device_release(int fd) {
+	if(fd != device.fd) close(fd);
+}
+
+
+/****************/
+/* Block cache. */
+/****************/
+
+static int cache_hash(long blockNumber) {
+	return (unsigned int) (blockNumber ^ blockNumber >> 32) * 2654435761u & (cache.nbuckets - 1);
+}
+
+static int cache_lookup(long blockNumber) {
+	for(int s = cache.buckets[cache_hash(blockNumber)]; s >= 0; s = cache.slots[s].hnext) {
+		if(cache.slots[s].block == blockNumber) return s;
+	}
+	return -1;
+}
+
+/*
+ * Finds a cached block, waiting for it if a read request is filling it.
+ * Returns the slot or -1 if the block is not cached.
+ */
+static int cache_find(long blockNumber) {
+	int s = cache_lookup(blockNumber);
+	while(s >= 0 && cache.slots[s].pending) {
+		if(ring_reap(1) < 0) return -1;
+		s = cache_lookup(blockNumber);
+	}
+	return s;
+}
+
+static void lru_unlink(int s) {
+	cache_slot *slot = &cache.slots[s];
+	if(slot->prev >= 0) cache.slots[slot->prev].next = slot->next;
+	else cache.head = slot->next;
+	if(slot->next >= 0) cache.slots[slot->next].prev = slot->prev;
+	else cache.tail = slot->prev;
+}
+
+static void lru_push_front(int s) {
+	cache.slots[s].prev = -1;
+	cache.slots[s].next = cache.head;
+	if(cache.head >= 0) cache.slots[cache.head].prev = s;
+	cache.head = s;
+	if(cache.tail < 0) cache.tail = s;
+}
+
+static void lru_push_back(int s) {
+	cache.slots[s].next = -1;
+	cache.slots[s].prev = cache.tail;
+	if(cache.tail >= 0) cache.slots[cache.tail].next = s;
+	cache.tail = s;
+	if(cache.head < 0) cache.head = s;
+}
+
+static void cache_touch(int s) {
+	if(cache.head == s) return;
+	lru_unlink(s);
+	lru_push_front(s);
+}
+
+static void cache_unhash(int s) {
+	int *link = &cache.buckets[cache_hash(cache.slots[s].block)];
+	while(*link != s) link = &cache.slots[*link].hnext;
+	*link = cache.slots[s].hnext;
+	cache.slots[s].block = -1;
+}
+
+/*
+ * Writes a dirty slot back to the device.
+ */
+static int cache_writeback(int s) {
+	if(block_transfer(device.fd, (off_t) BLOCK_SIZE * cache.slots[s].block, cache.slots[s].data, 1) != 0) return -1;
+	cache.slots[s].dirty = 0;
+	cache.ndirty--;
+	return 0;
+}
+
+/*
+ * Takes the least recently used slot that is not borrowed, writing it back
+ * if it is dirty, and assigns it to blockNumber. Returns the slot or -1 in case of error.
+ */
+static int cache_insert(long blockNumber) {
+	int s;
+	for(;;) {
+		s = cache.tail;
+		while(s >= 0 && cache.slots[s].pins > 0) s = cache.slots[s].prev;
+		if(s < 0) return -1;
+		if(!cache.slots[s].pending) break;
+		if(ring_reap(1) < 0) return -1;
+	}
+	if(cache.slots[s].dirty && cache_writeback(s) != 0) return -1;
+	if(cache.slots[s].block >= 0) cache_unhash(s);
+
+	int b = cache_hash(blockNumber);
+	cache.slots[s].block = blockNumber;
+	cache.slots[s].hnext = cache.buckets[b];
+	cache.buckets[b] = s;
+	cache_touch(s);
+	return s;
+}
+
+/*
+ * Gives a slot back to the free end of the LRU list.
+ */
+static void cache_drop(int s) {
+	if(cache.slots[s].pins > 0) return;
+	cache_unhash(s);
+	lru_unlink(s);
+	lru_push_back(s);
+}
+
+/*
+ * Stores a copy of a block that matches the device.
+ */
+static void cache_store(long blockNumber, char *buffer) {
+	int s = cache_lookup(blockNumber);
+	if(s >= 0) cache_touch(s);
+	else if((s = cache_insert(blockNumber)) < 0) return;
+	memcpy(cache.slots[s].data, buffer, BLOCK_SIZE);
+}
+
+/*
+ * Stores a block that is newer than the device and marks it dirty.
+ * Returns 0 or -1 in case of error.
+ */
+static int cache_write(long blockNumber, char *buffer) {
+	//A read in flight would overwrite the new data with the old
+	int s = cache_find(blockNumber);
+	if(s >= 0) {
+		cache_touch(s);
+		//Rewriting the same content costs nothing
+		if(memcmp(cache.slots[s].data, buffer, BLOCK_SIZE) == 0) return 0;
+	} else if((s = cache_insert(blockNumber)) < 0) {
+		return -1;
+	}
+	memcpy(cache.slots[s].data, buffer, BLOCK_SIZE);
+	if(!cache.slots[s].dirty) {
+		cache.slots[s].dirty = 1;
+		cache.ndirty++;
+	}
+	return 0;
+}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+/*******************/
+/* Block requests. */
+/*******************/
 
-	int total_read, read_result;
+/*
+ * Settles the cache after a request: flushed slots become clean and filled
+ * slots become readable, or are dropped if the read failed. The cached copies
+ * of caller blocks whose write failed are dropped as well.
+ */
+static void request_done(block_request *r, int ok) {
+	for(int k = 0; k < r->count; k++) {
+		int s = r->slots[k];
+		if(s < 0) {
+			if(r->write && !ok && cache.capacity > 0 && (s = cache_lookup(r->offset / BLOCK_SIZE + k)) >= 0) cache_drop(s);
+			continue;
+		}
+		if(r->write) {
+			if(ok && cache.slots[s].dirty) {
+				cache.slots[s].dirty = 0;
+				cache.ndirty--;
+			}
+		} else {
+			cache.slots[s].pending = 0;
+			if(!ok) cache_drop(s);
+		}
+	}
+	if(!ok && (r->write || r->slots[0] < 0)) io.failed = 1;
+}
+
+/*
+ * Takes one completion from the ring, finishing short transfers in place.
+ * Returns 1 if a request finished, 0 if none was ready or -1 in case of error.
+ */
+static int ring_reap(int wait) {
+	unsigned long long tag;
+	int result;
+	int ret = uring_reap(wait, &tag, &result);
+	if(ret <= 0) return ret;
 
-	total_read = 0;
-	do{
-		read_result = read(fd, buffer+total_read, BLOCK_SIZE-total_read);
-		total_read = total_read + read_result;
-	} while(total_read < BLOCK_SIZE && read_result >= 0);
+	block_request *r = &io.requests[tag];
+	ssize_t length = (ssize_t) r->count * BLOCK_SIZE;
+	int ok = result == length;
+	if(result >= 0 && result < length) {
+		//Short transfer: the rest is moved synchronously
+		struct iovec *iov = r->iov;
+		int iovcnt = r->count;
+		size_t done = result;
+		while(done >= iov->iov_len) {
+			done -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		iov->iov_base = (char *) iov->iov_base + done;
+		iov->iov_len -= done;
+		ok = vector_transfer(device.fd, r->offset + result, iov, iovcnt, r->write) == 0;
+	}
 
-	close(fd);
+	request_done(r, ok);
+	r->busy = 0;
+	io.inflight--;
+	if(r->write) io.writes--;
+	return 1;
+}
 
+/*
+ * Waits until no request is in flight.
+ * Returns 0 or -1 in case of error.
+ */
+static int ring_drain(void) {
+	if(io.inflight == 0) return 0;
+	if(uring_submit() != 0) return -1;
+	while(io.inflight > 0) {
+		if(ring_reap(1) < 0) return -1;
+	}
 	return 0;
 }
 
 /*
- * Writes a block from a buffer to the device.
+ * Returns a free request, reaping a completion if all of them are in flight.
+ */
+static block_request *request_get(void) {
+	if(io.backend == BLOCK_BACKEND_SYNC) return &io.requests[0];
+
+	for(;;) {
+		for(int i = 0; i < RING_ENTRIES; i++) {
+			if(!io.requests[i].busy) return &io.requests[i];
+		}
+		if(uring_submit() != 0 || ring_reap(1) < 0) return NULL;
+	}
+}
+
+/*
+ * Starts the transfer of the entries of blocks listed in order, sorted by
+ * block number, with one request per run of consecutive blocks. slots gives
+ * the cache slot behind each entry or is NULL for caller buffers. The
+ * synchronous backend finishes each request before returning; io_uring
+ * leaves them in flight until they are reaped.
  * Returns 0 or -1 in case of error.
  */
-int bwrite(char *deviceName, int blockNumber, char*buffer) {
-	int fd = open(deviceName, O_WRONLY);
+static int start_runs(block_io *blocks, int *order, int n, int write, int *slots) {
+	int ret = 0;
 
-	if(fd < 0){
-		/* fprintf(stderr, "ERROR: UNABLE TO OPEN DISK FILE %s \n", deviceName); */
+	for(int i = 0; i < n; ) {
+		block_request *r = request_get();
+		if(r == NULL) return -1;
+
+		long first = blocks[order[i]].blockNumber;
+		int run = 0;
+		while(i + run < n && run < MAX_RUN_BLOCKS && blocks[order[i+run]].blockNumber == first + run) {
+			int e = order[i+run];
+			r->iov[run].iov_base = blocks[e].buffer;
+			r->iov[run].iov_len = BLOCK_SIZE;
+			r->slots[run] = slots != NULL ? slots[e] : -1;
+			run++;
+		}
+		r->write = write;
+		r->count = run;
+		r->offset = (off_t) BLOCK_SIZE * first;
+		i += run;
+
+		if(io.backend == BLOCK_BACKEND_URING) {
+			for(int k = 0; !write && k < run; k++) {
+				if(r->slots[k] >= 0) cache.slots[r->slots[k]].pending = 1;
+			}
+			if(uring_queue(device.fd, r->offset, r->iov, run, write, r - io.requests) == 0) {
+				r->busy = 1;
+				io.inflight++;
+				if(write) io.writes++;
+				continue;
+			}
+		}
+
+		int ok = vector_transfer(device.fd, r->offset, r->iov, run, write) == 0;
+		request_done(r, ok);
+		if(!ok) ret = -1;
+	}
+
+	if(io.backend == BLOCK_BACKEND_URING && uring_submit() != 0) return -1;
+	return ret;
+}
+
+/*
+ * With the mmap backend blocks are copied straight from and to the mapping.
+ */
+static int map_active(char *deviceName) {
+	return io.map != NULL && strcmp(device.name, deviceName) == 0;
+}
+
+static int map_transfer(block_io *blocks, int count, int write) {
+	for(int i = 0; i < count; i++) {
+		if(block_offset(device.length, blocks[i].blockNumber) < 0) return -1;
+	}
+
+	for(int i = 0; i < count; i++) {
+		char *block = io.map + (off_t) BLOCK_SIZE * blocks[i].blockNumber;
+		if(write) memcpy(block, blocks[i].buffer, BLOCK_SIZE);
+		else memcpy(blocks[i].buffer, block, BLOCK_SIZE);
+	}
+	if(write && count > 0) io.mapDirty = 1;
+	return 0;
+}
+
+static int map_sync(void) {
+	if(!io.mapDirty) return 0;
+	if(msync(io.map, device.length, MS_SYNC) != 0) return -1;
+	io.mapDirty = 0;
+	return 0;
+}
+
+static int cache_active(char *deviceName) {
+	return cache.capacity > 0 && device.fd >= 0 && strcmp(device.name, deviceName) == 0;
+}
+
+static void cache_release(void) {
+	free(cache.slots);
+	free(cache.buckets);
+	free(cache.data);
+	memset(&cache, 0, sizeof(cache));
+}
+
+/*
+ * Puts a cache of capacity blocks in front of the device session.
+ * Returns 0 or -1 in case of error.
+ */
+int bcache_init(int capacity, int dirtyLimit) {
+	if(device.fd < 0 || capacity <= 0 || dirtyLimit < 0 || cache.capacity > 0) return -1;
+	//The mapping already keeps the blocks in memory
+	if(io.map != NULL) return 0;
+
+	int nbuckets = 1;
+	while(nbuckets < 2 * capacity) nbuckets <<= 1;
+
+	cache.slots = malloc(capacity * sizeof(cache_slot));
+	cache.buckets = malloc(nbuckets * sizeof(int));
+	cache.data = malloc((size_t) capacity * BLOCK_SIZE);
+	if(cache.slots == NULL || cache.buckets == NULL || cache.data == NULL) {
+		cache_release();
 		return -1;
 	}
 
-	int len = lseek(fd, 0, SEEK_END) + 1;
-	if((BLOCK_SIZE*blockNumber+BLOCK_SIZE) > len) {
+	cache.capacity = capacity;
+	cache.nbuckets = nbuckets;
+	cache.dirtyLimit = dirtyLimit;
+	cache.head = cache.tail = -1;
+	for(int b = 0; b < nbuckets; b++) cache.buckets[b] = -1;
+	for(int s = 0; s < capacity; s++) {
+		cache.slots[s].block = -1;
+		cache.slots[s].hnext = -1;
+		cache.slots[s].dirty = 0;
+		cache.slots[s].pending = 0;
+		cache.slots[s].pins = 0;
+		cache.slots[s].data = cache.data + (size_t) s * BLOCK_SIZE;
+		lru_push_back(s);
+	}
+	return 0;
+}
+
+/*
+ * Writes every dirty block of the cache to the device, in block order and
+ * with one vectored write per run of consecutive blocks. With io_uring all
+ * the runs are in flight at the same time.
+ * Returns 0 or -1 in case of error.
+ */
+int bflush(void) {
+	if(io.map != NULL) return map_sync();
+	if(cache.ndirty == 0) return 0;
+	if(ring_drain() != 0) return -1;
+
+	block_io *blocks = malloc(cache.ndirty * sizeof(block_io));
+	int *slots = malloc(cache.ndirty * sizeof(int));
+	int *order = malloc(cache.ndirty * sizeof(int));
+	int ret = -1;
+	if(blocks == NULL || slots == NULL || order == NULL) goto out;
+
+	int n = 0;
+	for(int s = 0; s < cache.capacity; s++) {
+		if(!cache.slots[s].dirty) continue;
+		blocks[n].blockNumber = cache.slots[s].block;
+		blocks[n].buffer = cache.slots[s].data;
+		slots[n] = s;
+		order[n] = n;
+		n++;
+	}
+	sort_order(blocks, order, n);
+
+	start_runs(blocks, order, n, 1, slots);
+	if(ring_drain() != 0) goto out;
+	ret = cache.ndirty == 0 ? 0 : -1;
+
+out:
+	free(blocks);
+	free(slots);
+	free(order);
+	return ret;
+}
+
+/*
+ * Writes the dirty blocks and waits until the device has stored everything
+ * written so far, so the writes that follow are ordered after them.
+ * Returns 0 or -1 in case of error.
+ */
+int bsync(void) {
+	if(device.fd < 0) return -1;
+	if(bflush() != 0) return -1;
+	//msync already waited for the mapping
+	if(io.map != NULL) return 0;
+	if(ring_drain() != 0) return -1;
+	return fdatasync(device.fd);
+}
+
+/*
+ * Loads into the cache the given blocks that are not there yet. Runs of
+ * consecutive blocks are read with one vectored call each. With io_uring the
+ * reads are left in flight and the blocks wait for them when accessed.
+ * Returns 0 or -1 in case of error.
+ */
+int bprefetch(char *deviceName, long *blocks, int count) {
+	//The kernel reads ahead the faults of the mapping by itself
+	if(!cache_active(deviceName) || count <= 0) return 0;
+	//Never push out what this same call has loaded
+	if(count > cache.capacity / 2) count = cache.capacity / 2;
+
+	block_io *missing = malloc(count * sizeof(block_io));
+	int *slots = malloc(count * sizeof(int));
+	int *order = malloc(count * sizeof(int));
+	int ret = -1;
+	if(missing == NULL || slots == NULL || order == NULL) goto out;
+
+	int n = 0;
+	for(int i = 0; i < count; i++) {
+		if(block_offset(device.length, blocks[i]) < 0 || cache_lookup(blocks[i]) >= 0) continue;
+
+		int s = cache_insert(blocks[i]);
+		if(s < 0) break;
+		missing[n].blockNumber = blocks[i];
+		missing[n].buffer = cache.slots[s].data;
+		slots[n] = s;
+		order[n] = n;
+		n++;
+	}
+	sort_order(missing, order, n);
+
+	ret = start_runs(missing, order, n, 0, slots);
+
+out:
+	free(missing);
+	free(slots);
+	free(order);
+	return ret;
+}
+
+/*
+ * Lends a read-only pointer to a block held by the cache or the mapping,
+ * reading it first if needed. The cached block is not evicted until brelease.
+ * Returns the pointer or NULL in case of error.
+ */
+const char *bborrow(char *deviceName, long blockNumber) {
+	if(map_active(deviceName)) {
+		if(block_offset(device.length, blockNumber) < 0) return NULL;
+		return io.map + (off_t) BLOCK_SIZE * blockNumber;
+	}
+	if(!cache_active(deviceName) || block_offset(device.length, blockNumber) < 0) return NULL;
+	if(io.writes > 0 && ring_drain() != 0) return NULL;
+
+	int s = cache_find(blockNumber);
+	if(s >= 0) {
+		cache.hits++;
+		cache_touch(s);
+	} else {
+		cache.misses++;
+		s = cache_insert(blockNumber);
+		if(s < 0) return NULL;
+		if(block_transfer(device.fd, (off_t) BLOCK_SIZE * blockNumber, cache.slots[s].data, 0) != 0) {
+			cache_drop(s);
+			return NULL;
+		}
+	}
+	cache.slots[s].pins++;
+	return cache.slots[s].data;
+}
+
+/*
+ * Gives back a pointer lent by bborrow. Any pointer inside the block is valid.
+ */
+void brelease(const char *block) {
+	if(cache.data == NULL || block < cache.data || block >= cache.data + (size_t) cache.capacity * BLOCK_SIZE) return;
+
+	int s = (block - cache.data) / BLOCK_SIZE;
+	if(cache.slots[s].pins > 0) cache.slots[s].pins--;
+}
+
+/*
+ * Returns the hit and miss counters of the block cache.
+ */
+void bcache_stats(unsigned long *hits, unsigned long *misses) {
+	*hits = cache.hits;
+	*misses = cache.misses;
+}
+
+
+/****************/
+/* Disk access. */
+/****************/
+
+/*
+ * Opens the device once and keeps its descriptor and length for the
+ * following bread/bwrite calls. Nested calls on the same device are counted.
+ * Returns 0 or -1 in case of error.
+ */
+int bopen(char *deviceName) {
+	if(device.fd >= 0) {
+		if(strcmp(device.name, deviceName) != 0) return -1;
+		device.refs++;
+		return 0;
+	}
+
+	if(strlen(deviceName) >= DEVICE_NAME_LENGTH) return -1;
+
+	int fd = open(deviceName, O_RDWR);
+	if(fd < 0) return -1;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
 		close(fd);
 		return -1;
 	}
 
-	lseek(fd, BLOCK_SIZE*blockNumber, SEEK_SET);
+	device.fd = fd;
+	device.length = st.st_size;
+	device.refs = 1;
+	strcpy(device.name, deviceName);
+	return 0;
+}
+
+/*
+ * Releases the session opened by bopen, closing the device on the last call.
+ * Returns 0 or -1 in case of error.
+ */
+int bclose(void) {
+	if(device.fd < 0) return -1;
+	if(--device.refs > 0) return 0;
 
-	int total_write, write_result;
+	int ret = bflush();
+	if(ring_drain() != 0) ret = -1;
+	if(bbackend(BLOCK_BACKEND_SYNC) != 0) ret = -1;
+	io.failed = 0;
+	cache_release();
+	if(close(device.fd) != 0) ret = -1;
+	device.fd = -1;
+	device.length = 0;
+	device.name[0] = '\0';
+	return ret;
+}
 
-	total_write = 0;
-	do{
-		write_result = write(fd, buffer+total_write, BLOCK_SIZE-total_write);
-		total_write = total_write + write_result;
-	} while(total_write < BLOCK_SIZE && write_result >= 0);
+/*
+ * Chooses how the device session moves blocks: BLOCK_BACKEND_SYNC,
+ * BLOCK_BACKEND_URING or BLOCK_BACKEND_MMAP. The mapping replaces the
+ * cache, so it has to be chosen before bcache_init.
+ * Returns 0 or -1 in case of error.
+ */
+int bbackend(int backend) {
+	if(device.fd < 0 || io.inflight > 0) return -1;
+	if(backend == io.backend) return 0;
+	if(backend != BLOCK_BACKEND_SYNC && backend != BLOCK_BACKEND_URING && backend != BLOCK_BACKEND_MMAP) return -1;
+	if(backend == BLOCK_BACKEND_MMAP && cache.capacity > 0) return -1;
 
-	close(fd);
+	//We leave the current backend
+	if(io.backend == BLOCK_BACKEND_URING) {
+		uring_exit();
+	} else if(io.backend == BLOCK_BACKEND_MMAP) {
+		int ret = map_sync();
+		munmap(io.map, device.length);
+		io.map = NULL;
+		if(ret != 0) {
+			io.backend = BLOCK_BACKEND_SYNC;
+			return -1;
+		}
+	}
+	io.backend = BLOCK_BACKEND_SYNC;
 
+	if(backend == BLOCK_BACKEND_URING) {
+		if(uring_init(RING_ENTRIES) != 0) return -1;
+	} else if(backend == BLOCK_BACKEND_MMAP) {
+		if(device.length <= 0) return -1;
+		char *map = mmap(NULL, device.length, PROT_READ | PROT_WRITE, MAP_SHARED, device.fd, 0);
+		if(map == MAP_FAILED) return -1;
+		io.map = map;
+		io.mapDirty = 0;
+	}
+	io.backend = backend;
 	return 0;
 }
+
+/*
+ * Starts the transfer of a list of blocks without waiting for it. Cached
+ * blocks are served or updated in memory; the rest become one request per
+ * run of consecutive blocks.
+ * Returns 0 or -1 in case of error.
+ */
+int bsubmit(char *deviceName, block_io *blocks, int count, int write) {
+	if(device.fd < 0 || strcmp(device.name, deviceName) != 0) return -1;
+	if(count <= 0) return 0;
+	if(map_active(deviceName)) return map_transfer(blocks, count, write);
+
+	int cached = cache_active(deviceName);
+	//Reads must see the writes already in flight
+	if(!write && io.writes > 0 && ring_drain() != 0) return -1;
+
+	int small[MAX_RUN_BLOCKS];
+	int *order = count <= MAX_RUN_BLOCKS ? small : malloc(count * sizeof(int));
+	int ret = -1;
+	if(order == NULL) return -1;
+
+	int n = 0;
+	for(int i = 0; i < count; i++) {
+		if(block_offset(device.length, blocks[i].blockNumber) < 0) goto out;
+		if(cached && write) {
+			if(cache.dirtyLimit > 0) {
+				if(cache_write(blocks[i].blockNumber, blocks[i].buffer) != 0) goto out;
+				continue;
+			}
+			int s = cache_find(blocks[i].blockNumber);
+			if(s >= 0 && memcmp(cache.slots[s].data, blocks[i].buffer, BLOCK_SIZE) == 0) continue;
+			//Dropped again by request_done if the write fails
+			cache_store(blocks[i].blockNumber, blocks[i].buffer);
+		} else if(cached) {
+			int s = cache_find(blocks[i].blockNumber);
+			if(s >= 0) {
+				cache.hits++;
+				cache_touch(s);
+				memcpy(blocks[i].buffer, cache.slots[s].data, BLOCK_SIZE);
+				continue;
+			}
+			cache.misses++;
+		}
+		order[n++] = i;
+	}
+	sort_order(blocks, order, n);
+
+	ret = start_runs(blocks, order, n, write, NULL);
+	if(ret == 0 && cached && cache.ndirty >= cache.dirtyLimit && cache.dirtyLimit > 0) ret = bflush();
+
+out:
+	if(order != small) free(order);
+	return ret;
+}
+
+/*
+ * Reaps the requests that have finished, waiting for all of them if wait is set.
+ * Returns 0 or -1 if a request failed since the last call.
+ */
+int bcomplete(int wait) {
+	if(io.backend == BLOCK_BACKEND_URING) {
+		if(uring_submit() != 0) return -1;
+		while(ring_reap(0) > 0);
+		if(wait && ring_drain() != 0) return -1;
+	}
+
+	int ret = io.failed ? -1 : 0;
+	io.failed = 0;
+	return ret;
+}
+
+/*
+ * Reads a list of blocks. Blocks found in the cache are copied from it and
+ * the rest are read with one vectored call per run of consecutive blocks.
+ * Returns 0 or -1 in case of error, including short read.
+ */
+int breadv(char *deviceName, block_io *blocks, int count) {
+	if(count <= 0) return 0;
+	if(map_active(deviceName)) return map_transfer(blocks, count, 0);
+
+	int cached = cache_active(deviceName);
+	//Reads must see the writes already in flight
+	if(io.writes > 0 && ring_drain() != 0) return -1;
+	off_t len;
+	int fd = device_acquire(deviceName, O_RDONLY, &len);
+	if(fd < 0) return -1;
+
+	int small[MAX_RUN_BLOCKS];
+	int *order = count <= MAX_RUN_BLOCKS ? small : malloc(count * sizeof(int));
+	int ret = -1;
+	if(order == NULL) goto out;
+
+	int n = 0;
+	for(int i = 0; i < count; i++) {
+		if(block_offset(len, blocks[i].blockNumber) < 0) goto out;
+		if(cached) {
+			int s = cache_find(blocks[i].blockNumber);
+			if(s >= 0) {
+				cache.hits++;
+				cache_touch(s);
+				memcpy(blocks[i].buffer, cache.slots[s].data, BLOCK_SIZE);
+				continue;
+			}
+			cache.misses++;
+		}
+		order[n++] = i;
+	}
+	sort_order(blocks, order, n);
+
+	if(runs_transfer(fd, blocks, order, n, 0) != 0) goto out;
+	if(cached) {
+		for(int i = 0; i < n; i++) cache_store(blocks[order[i]].blockNumber, blocks[order[i]].buffer);
+	}
+	ret = 0;
+
+out:
+	if(order != small) free(order);
+	device_release(fd);
+	return ret;
+}
+
+/*
+ * Writes a list of blocks. In write-back mode they stay dirty in the cache;
+ * otherwise the blocks that changed are written with one vectored call per
+ * run of consecutive blocks.
+ * Returns 0 or -1 in case of error.
+ */
+int bwritev(char *deviceName, block_io *blocks, int count) {
+	if(count <= 0) return 0;
+	if(map_active(deviceName)) return map_transfer(blocks, count, 1);
+
+	int cached = cache_active(deviceName);
+	//Synchronous writes are not mixed with requests in flight
+	if(ring_drain() != 0) return -1;
+	if(cached && cache.dirtyLimit > 0) {
+		for(int i = 0; i < count; i++) {
+			if(block_offset(device.length, blocks[i].blockNumber) < 0) return -1;
+			if(cache_write(blocks[i].blockNumber, blocks[i].buffer) != 0) return -1;
+		}
+		if(cache.ndirty >= cache.dirtyLimit) return bflush();
+		return 0;
+	}
+
+	off_t len;
+	int fd = device_acquire(deviceName, O_WRONLY, &len);
+	if(fd < 0) return -1;
+
+	int small[MAX_RUN_BLOCKS];
+	int *order = count <= MAX_RUN_BLOCKS ? small : malloc(count * sizeof(int));
+	int ret = -1;
+	if(order == NULL) goto out;
+
+	int n = 0;
+	for(int i = 0; i < count; i++) {
+		if(block_offset(len, blocks[i].blockNumber) < 0) goto out;
+		//Rewriting the same content costs nothing
+		if(cached) {
+			int s = cache_lookup(blocks[i].blockNumber);
+			if(s >= 0 && memcmp(cache.slots[s].data, blocks[i].buffer, BLOCK_SIZE) == 0) {
+				cache_touch(s);
+				continue;
+			}
+		}
+		order[n++] = i;
+	}
+	sort_order(blocks, order, n);
+
+	ret = runs_transfer(fd, blocks, order, n, 1);
+	//The cached copies follow the device (write-through)
+	if(cached) {
+		for(int i = 0; i < n; i++) {
+			long b = blocks[order[i]].blockNumber;
+			if(ret == 0) {
+				cache_store(b, blocks[order[i]].buffer);
+			} else {
+				int s = cache_lookup(b);
+				if(s >= 0) cache_drop(s);
+			}
+		}
+	}
+
+out:
+	if(order != small) free(order);
+	device_release(fd);
+	return ret;
+}
+
+/*
+ * Reads a block from the device and stores it in a buffer.
+ * Returns 0 or -1 in case of error, including short
+ * read.
+ */
+int bread(char *deviceName, long blockNumber, char *buffer) {
+	block_io block = { blockNumber, buffer };
+	return breadv(deviceName, &block, 1);
+}
+
+/*
+ * Writes a block from a buffer to the device.
+ * Returns 0 or -1 in case of error.
+ */
+int bwrite(char *deviceName, long blockNumber, char*buffer) {
+	block_io block = { blockNumber, buffer };
+	return bwritev(deviceName, &block, 1);
+}
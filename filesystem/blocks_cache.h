@@ -25,21 +25,133 @@
 
 #define BLOCK_SIZE 2048
 
+#define BLOCK_BACKEND_SYNC 0  // pread/pwrite from the calling thread
+#define BLOCK_BACKEND_URING 1 // Requests queued to an io_uring ring
+#define BLOCK_BACKEND_MMAP 2  // memcpy against a mapping of the whole device
+
+/*
+ * One entry of a vectored transfer: a block number and its BLOCK_SIZE buffer.
+ */
+typedef struct {
+	long blockNumber;
+	char *buffer;
+} block_io;
+
 
 /****************/
 /* Disk access. */
 /****************/
 
+/*
+ * Opens the device and keeps its descriptor and length cached, so the
+ * following bread/bwrite calls on it do not reopen the device.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bopen(char *deviceName);
+
+/*
+ * Closes the device session opened by bopen.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bclose(void);
+
+/*
+ * Puts a cache of the given capacity, in blocks, in front of the device
+ * session. With dirtyLimit > 0 written blocks are kept dirty in memory
+ * and written back by bflush, by eviction or when dirtyLimit of them
+ * accumulate; with 0 every bwrite goes through to the device.
+ * The cache is flushed and dropped by the last bclose.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bcache_init(int capacity, int dirtyLimit);
+
+/*
+ * Writes the dirty blocks of the cache (or of the mapping) to the device.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bflush(void);
+
+/*
+ * Writes the dirty blocks and waits until the device has stored every block
+ * written so far. Writes issued after it reach the device after them.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsync(void);
+
+/*
+ * Chooses how the device session moves blocks: BLOCK_BACKEND_SYNC (the
+ * default), BLOCK_BACKEND_URING or BLOCK_BACKEND_MMAP. With the mapping
+ * there is no block cache and bflush is an msync, so it has to be chosen
+ * before bcache_init.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bbackend(int backend);
+
+/*
+ * Starts reading or writing a list of blocks without waiting for the device.
+ * Runs of consecutive blocks become a single request. The buffers must stay
+ * untouched until bcomplete has waited for the requests, which are not
+ * ordered among themselves.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bsubmit(char *deviceName, block_io *blocks, int count, int write);
+
+/*
+ * Reaps the finished requests, waiting for all of them if wait is set.
+ * Returns 0 if correct or -1 if a request failed since the last call.
+ */
+int bcomplete(int wait);
+
+/*
+ * Loads the given blocks into the cache ahead of their bread, reading runs
+ * of consecutive blocks with a single call.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bprefetch(char *deviceName, long *blocks, int count);
+
+/*
+ * Lends a read-only pointer to a block kept in the cache or in the device
+ * mapping, so it can be used without copying it. The block stays in memory
+ * until brelease (or bclose).
+ * Returns the pointer or NULL in case of error.
+ */
+const char *bborrow(char *deviceName, long blockNumber);
+
+/*
+ * Gives back a block lent by bborrow. Any pointer inside the block is accepted.
+ */
+void brelease(const char *block);
+
+/*
+ * Returns the number of block reads served from the cache and from the device.
+ */
+void bcache_stats(unsigned long *hits, unsigned long *misses);
+
 /*
  * Reads a block from the device and stores it in a buffer.
  * Returns 0 if correct or -1 in case of error, including short
  * read.
  */
-int bread(char *deviceName, int blockNumber, char *buffer);
+int bread(char *deviceName, long blockNumber, char *buffer);
 
 /*
  * Writes a block from a buffer to the device.
  * Returns 0 if correct or -1 in case of error.
  */
-int bwrite(char *deviceName, int blockNumber, char*buffer);
+int bwrite(char *deviceName, long blockNumber, char*buffer);
+
+/*
+ * Reads count blocks, each into its own buffer. Runs of physically
+ * consecutive blocks are read with a single call.
+ * Returns 0 if correct or -1 in case of error, including short
+ * read.
+ */
+int breadv(char *deviceName, block_io *blocks, int count);
+
+/*
+ * Writes count blocks, each from its own buffer. Runs of physically
+ * consecutive blocks are written with a single call.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int bwritev(char *deviceName, block_io *blocks, int count);
 #endif
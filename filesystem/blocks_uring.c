@@ -0,0 +1,170 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	blocks_uring.c
+ * @brief 	Minimal io_uring ring over the raw system calls, used by the asynchronous
+ *              backend of blocks_cache.c.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#include "filesystem/blocks_uring.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Ring shared with the kernel: the submission queue (indices into sqes) and
+ * the completion queue, both mapped from the ring descriptor.
+ */
+static struct {
+	int fd;
+	unsigned entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+	unsigned queued;	// Requests queued but not submitted yet
+} ring = { -1 };
+
+
+/*
+ * Sets up a ring able to hold the given number of requests.
+ * Returns 0 or -1 in case of error.
+ */
+int uring_init(unsigned entries) {
+	if(ring.fd >= 0) return -1;
+
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, entries, &p);
+	if(fd < 0) return -1;
+
+	ring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(ring.cq_size > ring.sq_size) ring.sq_size = ring.cq_size;
+		ring.cq_size = ring.sq_size;
+	}
+
+	ring.sq_ptr = mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(ring.sq_ptr == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring.cq_ptr = ring.sq_ptr;
+	} else {
+		ring.cq_ptr = mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(ring.cq_ptr == MAP_FAILED) {
+			munmap(ring.sq_ptr, ring.sq_size);
+			close(fd);
+			return -1;
+		}
+	}
+	ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(ring.sqes == MAP_FAILED) {
+		if(ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_size);
+		munmap(ring.sq_ptr, ring.sq_size);
+		close(fd);
+		return -1;
+	}
+
+	char *sq = ring.sq_ptr, *cq = ring.cq_ptr;
+	ring.sq_head = (unsigned *) (sq + p.sq_off.head);
+	ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+	ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+	ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+	ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+	ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+	ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+	ring.entries = p.sq_entries;
+	ring.queued = 0;
+	ring.fd = fd;
+	return 0;
+}
+
+/*
+ * Tears down the ring.
+ */
+void uring_exit(void) {
+	if(ring.fd < 0) return;
+
+	munmap(ring.sqes, ring.sqes_size);
+	if(ring.cq_ptr != ring.sq_ptr) munmap(ring.cq_ptr, ring.cq_size);
+	munmap(ring.sq_ptr, ring.sq_size);
+	close(ring.fd);
+	ring.fd = -1;
+}
+
+/*
+ * Queues a vectored read or write.
+ * Returns 0 or -1 if the submission queue is full.
+ */
+int uring_queue(int fd, off_t offset, struct iovec *iov, int iovcnt, int write, unsigned long long tag) {
+	unsigned tail = *ring.sq_tail;
+	unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+	if(tail - head >= ring.entries) return -1;
+
+	unsigned index = tail & *ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = (unsigned long) iov;
+	sqe->len = iovcnt;
+	sqe->user_data = tag;
+	ring.sq_array[index] = index;
+
+	__atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring.queued++;
+	return 0;
+}
+
+/*
+ * Hands the queued requests to the kernel.
+ * Returns 0 or -1 in case of error.
+ */
+int uring_submit(void) {
+	while(ring.queued > 0) {
+		int result = syscall(__NR_io_uring_enter, ring.fd, ring.queued, 0, 0, NULL, 0);
+		if(result < 0) {
+			if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+			return -1;
+		}
+		ring.queued -= result;
+	}
+	return 0;
+}
+
+/*
+ * Takes one completion, waiting for it if wait is set.
+ * Returns 1 if a completion was taken, 0 if none was ready or -1 in case of error.
+ */
+int uring_reap(int wait, unsigned long long *tag, int *result) {
+	for(;;) {
+		unsigned head = *ring.cq_head;
+		unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		if(head != tail) {
+			struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+			*tag = cqe->user_data;
+			*result = cqe->res;
+			__atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+			return 1;
+		}
+		if(!wait) return 0;
+
+		if(syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) return -1;
+	}
+}
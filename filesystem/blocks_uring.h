@@ -0,0 +1,51 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	blocks_uring.h
+ * @brief 	Headers of the io_uring ring used by the asynchronous backend of blocks_cache.c.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#ifndef _BLOCKS_URING_H_
+#define _BLOCKS_URING_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Sets up a ring able to hold the given number of requests.
+ * Returns 0 if correct or -1 in case of error (e.g. io_uring not available).
+ */
+int uring_init(unsigned entries);
+
+/*
+ * Tears down the ring. Requests still in flight are abandoned.
+ */
+void uring_exit(void);
+
+/*
+ * Queues a vectored read or write of iovcnt buffers at offset. The buffers
+ * and iov must stay valid until the request is reaped. tag is returned by
+ * uring_reap with the result.
+ * Returns 0 if correct or -1 if the submission queue is full.
+ */
+int uring_queue(int fd, off_t offset, struct iovec *iov, int iovcnt, int write, unsigned long long tag);
+
+/*
+ * Hands the queued requests to the kernel with a single system call.
+ * Returns 0 if correct or -1 in case of error.
+ */
+int uring_submit(void);
+
+/*
+ * Takes one completion, waiting for it if wait is set. Stores its tag and
+ * its result (bytes transferred or -errno).
+ * Returns 1 if a completion was taken, 0 if none was ready or -1 in case of error.
+ */
+int uring_reap(int wait, unsigned long long *tag, int *result);
+
+#endif
@@ -16,6 +16,14 @@
 #include "filesystem/crc.h"	// Headers for the CRC functionality
 
 #include "zlib/zlib.h"			// Auxiliary library for CRC32
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>			// CPU features, for the kernel dispatch
+#include <nmmintrin.h>			// crc32 instruction of SSE4.2
+#include <wmmintrin.h>			// Carry-less multiplication
+#include <smmintrin.h>
+#endif
 
 // Look-up table for CRC16
 static const uint16_t crc16tab[256]= {
@@ -185,9 +193,69 @@ static const uint64_t crc64_tab[256] = {
     UINT64_C(0x536fa08fdfd90e51), UINT64_C(0x29b7d047efec8728),
 };
 
+// Slicing tables for CRC16 and CRC64: entry n of table k is the CRC of byte n followed by k zero bytes
+static uint16_t crc16_slice[8][256];
+static uint64_t crc64_slice[8][256];
 
 /*
- * @brief	CRC16 implementation based on a CRC16-CCITT implementation variant with init value of 0.
+ * @brief	Builds the slicing tables from crc16tab and crc64_tab once at startup.
+ */
+__attribute__((constructor))
+static void crc_slice_init(void)
+{
+	for(int n = 0; n < 256; n++){
+		crc16_slice[0][n] = crc16tab[n];
+		crc64_slice[0][n] = crc64_tab[n];
+	}
+	for(int k = 1; k < 8; k++){
+		for(int n = 0; n < 256; n++){
+			uint16_t c16 = crc16_slice[k-1][n];
+			uint64_t c64 = crc64_slice[k-1][n];
+			crc16_slice[k][n] = (uint16_t) (c16 << 8) ^ crc16tab[c16 >> 8];
+			crc64_slice[k][n] = (c64 >> 8) ^ crc64_tab[c64 & 0xFF];
+		}
+	}
+}
+
+// Look-up table for CRC32C (Castagnoli polynomial, reflected)
+static const uint32_t crc32c_tab[256] = {
+	0x00000000,0xf26b8303,0xe13b70f7,0x1350f3f4,0xc79a971f,0x35f1141c,0x26a1e7e8,0xd4ca64eb,
+	0x8ad958cf,0x78b2dbcc,0x6be22838,0x9989ab3b,0x4d43cfd0,0xbf284cd3,0xac78bf27,0x5e133c24,
+	0x105ec76f,0xe235446c,0xf165b798,0x030e349b,0xd7c45070,0x25afd373,0x36ff2087,0xc494a384,
+	0x9a879fa0,0x68ec1ca3,0x7bbcef57,0x89d76c54,0x5d1d08bf,0xaf768bbc,0xbc267848,0x4e4dfb4b,
+	0x20bd8ede,0xd2d60ddd,0xc186fe29,0x33ed7d2a,0xe72719c1,0x154c9ac2,0x061c6936,0xf477ea35,
+	0xaa64d611,0x580f5512,0x4b5fa6e6,0xb93425e5,0x6dfe410e,0x9f95c20d,0x8cc531f9,0x7eaeb2fa,
+	0x30e349b1,0xc288cab2,0xd1d83946,0x23b3ba45,0xf779deae,0x05125dad,0x1642ae59,0xe4292d5a,
+	0xba3a117e,0x4851927d,0x5b016189,0xa96ae28a,0x7da08661,0x8fcb0562,0x9c9bf696,0x6ef07595,
+	0x417b1dbc,0xb3109ebf,0xa0406d4b,0x522bee48,0x86e18aa3,0x748a09a0,0x67dafa54,0x95b17957,
+	0xcba24573,0x39c9c670,0x2a993584,0xd8f2b687,0x0c38d26c,0xfe53516f,0xed03a29b,0x1f682198,
+	0x5125dad3,0xa34e59d0,0xb01eaa24,0x42752927,0x96bf4dcc,0x64d4cecf,0x77843d3b,0x85efbe38,
+	0xdbfc821c,0x2997011f,0x3ac7f2eb,0xc8ac71e8,0x1c661503,0xee0d9600,0xfd5d65f4,0x0f36e6f7,
+	0x61c69362,0x93ad1061,0x80fde395,0x72966096,0xa65c047d,0x5437877e,0x4767748a,0xb50cf789,
+	0xeb1fcbad,0x197448ae,0x0a24bb5a,0xf84f3859,0x2c855cb2,0xdeeedfb1,0xcdbe2c45,0x3fd5af46,
+	0x7198540d,0x83f3d70e,0x90a324fa,0x62c8a7f9,0xb602c312,0x44694011,0x5739b3e5,0xa55230e6,
+	0xfb410cc2,0x092a8fc1,0x1a7a7c35,0xe811ff36,0x3cdb9bdd,0xceb018de,0xdde0eb2a,0x2f8b6829,
+	0x82f63b78,0x709db87b,0x63cd4b8f,0x91a6c88c,0x456cac67,0xb7072f64,0xa457dc90,0x563c5f93,
+	0x082f63b7,0xfa44e0b4,0xe9141340,0x1b7f9043,0xcfb5f4a8,0x3dde77ab,0x2e8e845f,0xdce5075c,
+	0x92a8fc17,0x60c37f14,0x73938ce0,0x81f80fe3,0x55326b08,0xa759e80b,0xb4091bff,0x466298fc,
+	0x1871a4d8,0xea1a27db,0xf94ad42f,0x0b21572c,0xdfeb33c7,0x2d80b0c4,0x3ed04330,0xccbbc033,
+	0xa24bb5a6,0x502036a5,0x4370c551,0xb11b4652,0x65d122b9,0x97baa1ba,0x84ea524e,0x7681d14d,
+	0x2892ed69,0xdaf96e6a,0xc9a99d9e,0x3bc21e9d,0xef087a76,0x1d63f975,0x0e330a81,0xfc588982,
+	0xb21572c9,0x407ef1ca,0x532e023e,0xa145813d,0x758fe5d6,0x87e466d5,0x94b49521,0x66df1622,
+	0x38cc2a06,0xcaa7a905,0xd9f75af1,0x2b9cd9f2,0xff56bd19,0x0d3d3e1a,0x1e6dcdee,0xec064eed,
+	0xc38d26c4,0x31e6a5c7,0x22b65633,0xd0ddd530,0x0417b1db,0xf67c32d8,0xe52cc12c,0x1747422f,
+	0x49547e0b,0xbb3ffd08,0xa86f0efc,0x5a048dff,0x8ecee914,0x7ca56a17,0x6ff599e3,0x9d9e1ae0,
+	0xd3d3e1ab,0x21b862a8,0x32e8915c,0xc083125f,0x144976b4,0xe622f5b7,0xf5720643,0x07198540,
+	0x590ab964,0xab613a67,0xb831c993,0x4a5a4a90,0x9e902e7b,0x6cfbad78,0x7fab5e8c,0x8dc0dd8f,
+	0xe330a81a,0x115b2b19,0x020bd8ed,0xf0605bee,0x24aa3f05,0xd6c1bc06,0xc5914ff2,0x37faccf1,
+	0x69e9f0d5,0x9b8273d6,0x88d28022,0x7ab90321,0xae7367ca,0x5c18e4c9,0x4f48173d,0xbd23943e,
+	0xf36e6f75,0x0105ec76,0x12551f82,0xe03e9c81,0x34f4f86a,0xc69f7b69,0xd5cf889d,0x27a40b9e,
+	0x79b737ba,0x8bdcb4b9,0x988c474d,0x6ae7c44e,0xbe2da0a5,0x4c4623a6,0x5f16d052,0xad7d5351
+};
+
+
+/*
+ * @brief	CRC16 implementation based on a CRC16-CCITT implementation variant with init value of 0, sliced by 8 bytes.
  *
  * @param	<buffer> to compute the CRC on.
  * @param	<length> of the buffer, in bytes.
@@ -209,16 +277,188 @@ static const uint64_t crc64_tab[256] = {
  */
 uint16_t CRC16(const unsigned char* buffer, unsigned int length)
 {
-	register int counter;
-	register uint16_t crc = 0;
-	for( counter = 0; counter < length; counter++)
+	crc16_ctx ctx;
+	CRC16_init(&ctx);
+	CRC16_update(&ctx, buffer, length);
+	return CRC16_final(&ctx);
+}
+
+/*
+ * @brief	Streaming CRC16, the running CRC kept in a context: init, update with each piece, final.
+ */
+void CRC16_init(crc16_ctx *ctx)
+{
+	ctx->crc = 0;
+}
+
+void CRC16_update(crc16_ctx *ctx, const unsigned char* buffer, unsigned int length)
+{
+	register unsigned int counter = 0;
+	register uint16_t crc = ctx->crc;
+	//Eight bytes at a time through the slicing tables, the first two carrying the CRC so far
+	for( ; length - counter >= 8; counter += 8, buffer += 8)
+		crc = crc16_slice[7][(crc>>8) ^ buffer[0]] ^ crc16_slice[6][(crc&0x00FF) ^ buffer[1]] ^
+		      crc16_slice[5][buffer[2]] ^ crc16_slice[4][buffer[3]] ^ crc16_slice[3][buffer[4]] ^
+		      crc16_slice[2][buffer[5]] ^ crc16_slice[1][buffer[6]] ^ crc16_slice[0][buffer[7]];
+	for( ; counter < length; counter++)
 		crc = (crc<<8) ^ crc16tab[((crc>>8) ^ *(char *)buffer++)&0x00FF];
+	ctx->crc = crc;
+}
+
+uint16_t CRC16_final(crc16_ctx *ctx)
+{
+	return ctx->crc;
+}
+
+
+/*
+ * @brief	Portable CRC32 kernel: ZLIB's table-driven CRC32, on the CRC before its final xor.
+ */
+static uint32_t crc32_portable(uint32_t crc, const unsigned char* buffer, unsigned int length)
+{
+	return (uint32_t) ~crc32(~crc & 0xFFFFFFFF, buffer, length);
+}
+
+/*
+ * @brief	Portable CRC32C kernel, a byte at a time through crc32c_tab, on the CRC before its final xor.
+ */
+static uint32_t crc32c_portable(uint32_t crc, const unsigned char* buffer, unsigned int length)
+{
+	for(unsigned int i = 0; i < length; i++)
+		crc = crc32c_tab[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * @brief	CRC32C kernel with the crc32 instruction of SSE4.2, eight bytes at a time once the buffer is aligned.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* buffer, unsigned int length)
+{
+	for(; length > 0 && ((uintptr_t) buffer & 7) != 0; length--)
+		crc = _mm_crc32_u8(crc, *buffer++);
+#if defined(__x86_64__)
+	uint64_t crc64 = crc;
+	for(; length >= 8; length -= 8, buffer += 8){
+		uint64_t word;
+		memcpy(&word, buffer, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (uint32_t) crc64;
+#endif
+	for(; length >= 4; length -= 4, buffer += 4){
+		uint32_t word;
+		memcpy(&word, buffer, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	for(; length > 0; length--)
+		crc = _mm_crc32_u8(crc, *buffer++);
 	return crc;
 }
 
+/*
+ * @brief	CRC32 kernel folding 64 bytes at a time with carry-less multiplications (PCLMULQDQ), as in
+ *		"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+ *		The bytes after the last multiple of 16 go through the portable kernel.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char* buffer, unsigned int length)
+{
+	//Constants of the paper for the bit-reflected CRC32 polynomial: x^(4*128+64), x^(4*128), ...
+	static const uint64_t __attribute__((aligned(16))) k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+	static const uint64_t __attribute__((aligned(16))) k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+	static const uint64_t __attribute__((aligned(16))) k5k0[] = { 0x0163cd6124, 0x0000000000 };
+	static const uint64_t __attribute__((aligned(16))) poly[] = { 0x01db710641, 0x01f7011641 };
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	if(length < 64) return crc32_portable(crc, buffer, length);
+	unsigned int rest = length & 15;
+	length -= rest;
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (buffer + 0x00)), _mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i *) (buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buffer + 0x30));
+	buffer += 64;
+	length -= 64;
+
+	//Four lanes are folded 64 bytes forward at a time
+	x0 = _mm_load_si128((const __m128i *) k1k2);
+	for(; length >= 64; length -= 64, buffer += 64){
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (buffer + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buffer + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buffer + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buffer + 0x30)));
+	}
+
+	//The lanes are folded into one, that then takes the remaining 16 byte blocks
+	x0 = _mm_load_si128((const __m128i *) k3k4);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+	for(; length >= 16; length -= 16, buffer += 16){
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *) buffer)), x5);
+	}
+
+	//128 bits are folded to 64 and reduced to 32 with Barrett's method
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, x0, 0x00), x2);
+	x0 = _mm_load_si128((const __m128i *) poly);
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = (uint32_t) _mm_extract_epi32(x1, 1);
+
+	return crc32_portable(crc, buffer, rest);
+}
+
+#endif
+
+// Kernels used by CRC32 and CRC32C, the portable ones until crc_dispatch sees what the CPU has
+static uint32_t (*crc32_kernel)(uint32_t, const unsigned char*, unsigned int) = crc32_portable;
+static uint32_t (*crc32c_kernel)(uint32_t, const unsigned char*, unsigned int) = crc32c_portable;
 
 /*
- * @brief	CRC32 wrapper for ZLIB's CRC32 implementation with init value set to 0.
+ * @brief	Chooses the fastest CRC kernels the CPU supports, as reported by CPUID, once at startup.
+ */
+__attribute__((constructor))
+static void crc_dispatch(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return;
+	if(ecx & bit_SSE4_2) crc32c_kernel = crc32c_sse42;
+	if((ecx & bit_SSE4_1) && (ecx & bit_PCLMUL)) crc32_kernel = crc32_pclmul;
+#endif
+}
+
+/*
+ * @brief	CRC32 with init value set to 0, the same as ZLIB's CRC32.
  *
  * @param	<buffer> to compute the CRC on.
  * @param	<length> of the buffer, in bytes.
@@ -226,11 +466,110 @@ uint16_t CRC16(const unsigned char* buffer, unsigned int length)
  */
 uint32_t CRC32(const unsigned char* buffer, unsigned int length)
 {
-	return (uint32_t) (crc32(crc32(0L, Z_NULL, 0), buffer, length) & 0xFFFFFFFF);
+	return crc32_kernel(0xFFFFFFFF, buffer, length) ^ 0xFFFFFFFF;
+}
+
+/*
+ * @brief	Streaming CRC32, the running CRC kept in a context: init, update with each piece, final.
+ */
+void CRC32_init(crc32_ctx *ctx)
+{
+	ctx->crc = 0xFFFFFFFF;
+}
+
+void CRC32_update(crc32_ctx *ctx, const unsigned char* buffer, unsigned int length)
+{
+	ctx->crc = crc32_kernel(ctx->crc, buffer, length);
+}
+
+uint32_t CRC32_final(crc32_ctx *ctx)
+{
+	return ctx->crc ^ 0xFFFFFFFF;
 }
 
 /*
- * @brief	CRC64 implementation based on Redis' CRC64 variant with "Jones" coefficients and init value of 0.
+ * @brief	CRC32C implementation (Castagnoli polynomial) with init value and final xor of 0xFFFFFFFF.
+ *
+ * @param	<buffer> to compute the CRC on.
+ * @param	<length> of the buffer, in bytes.
+ * @return	A 32-bit unsigned integer containing the resulting CRC.
+ */
+uint32_t CRC32C(const unsigned char* buffer, unsigned int length)
+{
+	return crc32c_kernel(0xFFFFFFFF, buffer, length) ^ 0xFFFFFFFF;
+}
+
+/*
+ * @brief	Streaming CRC32C, the running CRC kept in a context: init, update with each piece, final.
+ */
+void CRC32C_init(crc32c_ctx *ctx)
+{
+	ctx->crc = 0xFFFFFFFF;
+}
+
+void CRC32C_update(crc32c_ctx *ctx, const unsigned char* buffer, unsigned int length)
+{
+	ctx->crc = crc32c_kernel(ctx->crc, buffer, length);
+}
+
+uint32_t CRC32C_final(crc32c_ctx *ctx)
+{
+	return ctx->crc ^ 0xFFFFFFFF;
+}
+
+// x^(2^k) modulo the CRC32C polynomial, for k from 0 to 31. They repeat every 31, the last one is the first again
+static const uint32_t crc32c_x2n[32] = {
+	0x40000000,0x20000000,0x08000000,0x00800000,0x00008000,0x82f63b78,0x6ea2d55c,0x18b8ea18,
+	0x510ac59a,0xb82be955,0xb8fdb1e7,0x88e56f72,0x74c360a4,0xe4172b16,0x0d65762a,0x35d73a62,
+	0x28461564,0xbf455269,0xe2ea32dc,0xfe7740e6,0xf946610b,0x3c204f8f,0x538586e3,0x59726915,
+	0x734d5309,0xbc1ac763,0x7d0722cc,0xd289cabe,0xe94ca9bc,0x05b74f3f,0xa51e1f42,0x40000000
+};
+
+/*
+ * @brief	Multiplies two polynomials modulo the CRC32C polynomial, both reflected as the CRC is.
+ */
+static uint32_t crc32c_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = (uint32_t) 1 << 31, p = 0;
+	for(;;){
+		if(a & m){
+			p ^= b;
+			if((a & (m - 1)) == 0) break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0x82f63b78 : b >> 1;
+	}
+	return p;
+}
+
+/*
+ * @brief	CRC32C of two buffers one after the other, from the CRC32C of each one, as zlib's crc32_combine
+ *		does for CRC32. The CRC of the first is moved past length2 zero bytes with x^(8*length2),
+ *		built from the powers in crc32c_x2n, so it takes no time proportional to length2.
+ *
+ * @param	<crc1> of the first buffer.
+ * @param	<crc2> of the second buffer.
+ * @param	<length2> of the second buffer, in bytes.
+ * @return	A 32-bit unsigned integer containing the resulting CRC.
+ */
+uint32_t CRC32C_combine(uint32_t crc1, uint32_t crc2, uint64_t length2)
+{
+	uint32_t p = (uint32_t) 1 << 31; //x^0
+	for(int k = 3; length2 != 0; length2 >>= 1, k++)
+		if(length2 & 1) p = crc32c_multmodp(crc32c_x2n[k % 31], p);
+	return crc32c_multmodp(p, crc1) ^ crc2;
+}
+
+/*
+ * @brief	Continues a running CRC32C with a piece of which only its CRC32C is known.
+ */
+void CRC32C_append(crc32c_ctx *ctx, uint32_t crc, uint64_t length)
+{
+	ctx->crc = CRC32C_combine(ctx->crc ^ 0xFFFFFFFF, crc, length) ^ 0xFFFFFFFF;
+}
+
+/*
+ * @brief	CRC64 implementation based on Redis' CRC64 variant with "Jones" coefficients and init value of 0, sliced by 8 bytes.
  *
  * @param	<buffer> to compute the CRC on.
  * @param	<length> of the buffer, in bytes.
@@ -252,11 +591,42 @@ uint32_t CRC32(const unsigned char* buffer, unsigned int length)
  * POSSIBILITY OF SUCH DAMAGE.
  */
 uint64_t CRC64(const unsigned char* buffer, unsigned int length) {
-    uint64_t j, crc = 0;
+    crc64_ctx ctx;
+    CRC64_init(&ctx);
+    CRC64_update(&ctx, buffer, length);
+    return CRC64_final(&ctx);
+}
+
+/*
+ * @brief	Streaming CRC64, the running CRC kept in a context: init, update with each piece, final.
+ */
+void CRC64_init(crc64_ctx *ctx) {
+    ctx->crc = 0;
+}
+
+void CRC64_update(crc64_ctx *ctx, const unsigned char* buffer, unsigned int length) {
+    uint64_t j = 0, crc = ctx->crc;
 
-    for (j = 0; j < length; j++) {
+    /* Eight bytes at a time through the slicing tables, read as a little-endian word. */
+    for (; length - j >= 8; j += 8) {
+        uint64_t word;
+        memcpy(&word, buffer + j, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        crc ^= word;
+        crc = crc64_slice[7][crc & 0xFF] ^ crc64_slice[6][(crc >> 8) & 0xFF] ^
+              crc64_slice[5][(crc >> 16) & 0xFF] ^ crc64_slice[4][(crc >> 24) & 0xFF] ^
+              crc64_slice[3][(crc >> 32) & 0xFF] ^ crc64_slice[2][(crc >> 40) & 0xFF] ^
+              crc64_slice[1][(crc >> 48) & 0xFF] ^ crc64_slice[0][crc >> 56];
+    }
+    for (; j < length; j++) {
         uint8_t byte = buffer[j];
         crc = crc64_tab[(uint8_t)crc ^ byte] ^ (crc >> 8);
     }
-    return crc;
+    ctx->crc = crc;
+}
+
+uint64_t CRC64_final(crc64_ctx *ctx) {
+    return ctx->crc;
 }
@@ -18,6 +18,15 @@
 
 #include <stdint.h>
 
+/*
+ * Running CRC of data given in pieces: _init, then _update with each
+ * piece in order, then _final gives the same CRC as the whole data at once.
+ */
+typedef struct { uint16_t crc; } crc16_ctx;
+typedef struct { uint32_t crc; } crc32_ctx;
+typedef struct { uint32_t crc; } crc32c_ctx;
+typedef struct { uint64_t crc; } crc64_ctx;
+
 /*
  * @brief	CRC16 implementation.
  *
@@ -27,6 +36,18 @@
  */
 uint16_t CRC16(const unsigned char* buffer, unsigned int length);
 
+/*
+ * @brief	Streaming CRC16: starts, continues with the next piece of data, or ends a running CRC.
+ *
+ * @param	<ctx> with the running CRC.
+ * @param	<buffer> with the next piece of data.
+ * @param	<length> of the buffer, in bytes.
+ * @return	CRC16_final returns the 16-bit CRC of every piece given.
+ */
+void CRC16_init(crc16_ctx *ctx);
+void CRC16_update(crc16_ctx *ctx, const unsigned char* buffer, unsigned int length);
+uint16_t CRC16_final(crc16_ctx *ctx);
+
 /*
  * @brief	CRC32 implementation.
  *
@@ -36,6 +57,59 @@ uint16_t CRC16(const unsigned char* buffer, unsigned int length);
  */
 
 uint32_t CRC32(const unsigned char* buffer, unsigned int length);
+
+/*
+ * @brief	Streaming CRC32: starts, continues with the next piece of data, or ends a running CRC.
+ *
+ * @param	<ctx> with the running CRC.
+ * @param	<buffer> with the next piece of data.
+ * @param	<length> of the buffer, in bytes.
+ * @return	CRC32_final returns the 32-bit CRC of every piece given.
+ */
+void CRC32_init(crc32_ctx *ctx);
+void CRC32_update(crc32_ctx *ctx, const unsigned char* buffer, unsigned int length);
+uint32_t CRC32_final(crc32_ctx *ctx);
+
+/*
+ * @brief	CRC32C implementation.
+ *
+ * @param	<buffer> to compute the CRC on.
+ * @param	<length> of the buffer, in bytes.
+ * @return	A 32-bit unsigned integer containing the resulting CRC.
+ */
+uint32_t CRC32C(const unsigned char* buffer, unsigned int length);
+
+/*
+ * @brief	Streaming CRC32C: starts, continues with the next piece of data, or ends a running CRC.
+ *
+ * @param	<ctx> with the running CRC.
+ * @param	<buffer> with the next piece of data.
+ * @param	<length> of the buffer, in bytes.
+ * @return	CRC32C_final returns the 32-bit CRC of every piece given.
+ */
+void CRC32C_init(crc32c_ctx *ctx);
+void CRC32C_update(crc32c_ctx *ctx, const unsigned char* buffer, unsigned int length);
+uint32_t CRC32C_final(crc32c_ctx *ctx);
+
+/*
+ * @brief	Combination of two CRC32C.
+ *
+ * @param	<crc1> of the first buffer.
+ * @param	<crc2> of the second buffer, that goes after the first.
+ * @param	<length2> of the second buffer, in bytes.
+ * @return	The CRC32C of both buffers together.
+ */
+uint32_t CRC32C_combine(uint32_t crc1, uint32_t crc2, uint64_t length2);
+
+/*
+ * @brief	Continues a running CRC32C with a piece of data of which only its CRC32C is known.
+ *
+ * @param	<ctx> with the running CRC.
+ * @param	<crc> of the piece.
+ * @param	<length> of the piece, in bytes.
+ */
+void CRC32C_append(crc32c_ctx *ctx, uint32_t crc, uint64_t length);
+
 /*
  * @brief	CRC64 implementation.
  *
@@ -45,4 +119,16 @@ uint32_t CRC32(const unsigned char* buffer, unsigned int length);
  */
 uint64_t CRC64(const unsigned char * buffer, unsigned int length);
 
+/*
+ * @brief	Streaming CRC64: starts, continues with the next piece of data, or ends a running CRC.
+ *
+ * @param	<ctx> with the running CRC.
+ * @param	<buffer> with the next piece of data.
+ * @param	<length> of the buffer, in bytes.
+ * @return	CRC64_final returns the 64-bit CRC of every piece given.
+ */
+void CRC64_init(crc64_ctx *ctx);
+void CRC64_update(crc64_ctx *ctx, const unsigned char* buffer, unsigned int length);
+uint64_t CRC64_final(crc64_ctx *ctx);
+
 #endif
@@ -12,38 +12,177 @@
 
 
 #include "filesystem/filesystem.h" // Headers for the core functionality
-#include "filesystem/auxiliary.h"  // Headers for auxiliary functions
 #include "filesystem/metadata.h"   // Type and structure declaration of the file system
+#include "filesystem/auxiliary.h"  // Headers for auxiliary functions
+#include "filesystem/workers.h"    // Threads that verify the checksums
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-char i_map[MAX_N_INODES]; //Inode map
-char b_map[MAX_SIZE_SYS_FILES / BLOCK_SIZE]; //Block map
+uint64_t *i_map = NULL; //Inode map, sized by the superblock
+uint64_t *b_map = NULL; //Block map, sized by the superblock
+uint64_t *iMapDirty = NULL, *bMapDirty = NULL; //Blocks of the maps changed since they were written in place
+uint64_t *iMapLog = NULL, *bMapLog = NULL; //Blocks of the maps changed since they were logged
+int sbDirty = 0; //Changes of the superblock, META_UNSAVED and META_UNLOGGED
+
+#define META_UNSAVED 1 //Changed since it was written in its place
+#define META_UNLOGGED 2 //Changed since it was logged to the journal
+long iHint = 0, bHint = 0; //Where ialloc and balloc resume their search
 sb sbk[1]; //Superblock
-inode inodo[MAX_N_INODES]; //Inode structure
 char *disk = "disk.dat";
 
+//Table of the disk of which a few blocks are kept in memory, read the first time they are used
+typedef struct{
+
+  char **data; //Blocks in memory, one for each slot
+  long *block; //Block of the table in each slot, -1 if empty
+  unsigned long *used; //When each slot was used for the last time
+  char *dirty; //Changes of each slot, META_UNSAVED and META_UNLOGGED
+  int *slot; //Slot of each block of the table, -1 if it is not in memory
+  int slots; //Slots in memory, more while every slot holds changes not yet logged
+  unsigned long clock; //Uses of the table so far
+  long first; //First block of the table in the device
+  long blocks; //Blocks of the table
+
+}table_cache;
+
+table_cache inodes; //Inode table
+table_cache names; //Name index, the first inode of each bucket plus one (0 if empty)
+table_cache sums; //Checksums of the data blocks, the CRC32C of each one
+int tableSlots = DEFAULT_INODE_CACHE; //Blocks of each table kept in memory, at least 2
+int openFiles = 0; //Inodes open
+
+//Journal of the metadata: a ring of transactions, each a descriptor and the blocks it logs
+typedef struct{
+
+  long first; //First block of the ring in the device
+  long blocks; //Blocks of the ring, 0 without journal
+  long start; //Where the oldest transaction not yet written in place starts
+  long head; //Where the next transaction goes
+  long used; //Blocks of the ring in use
+  uint64_t sequence; //Sequence of the next transaction
+  long pending; //Blocks changed since the last commit
+  int ops; //Operations since the last commit
+  int groupOps; //Operations committed together
+  long *extra; //Blocks of extent trees changed since the last commit, kept until it
+  char *extraData;
+  int nExtra;
+  int maxExtra;
+  long *logged; //Blocks of trees in the transactions of the ring, that a replay would write again
+  long nLogged;
+  long *revoked; //Blocks of those freed since the last commit, that a replay has to leave alone
+  int nRevoked;
+
+}journal_state;
+
+journal_state journal;
+int groupCommit = DEFAULT_GROUP_COMMIT; //Operations committed together to the journal
+
+static int zeroBlocks(long first, long count);
+static void tableDirty(table_cache *table, long k);
+static int sumStore(long b, uint32_t crc);
+static int blockCheck(int fd, int i, long b, const char *data);
+static int hashUpdate(int fd, int first, int count, const uint32_t *crcs);
+static int hashBuild(int fd);
+static int hashFree(uint64_t b, int depth);
+static int extentFree(extent *ext, int n, int depth);
+static const uint32_t *hashLeaf(int fd, int leaf);
+static void hashForget(void);
+static int journalOpen(void);
+static int journalReserve(long count);
+static int superblockWrite(void);
+
+//State of each open file, kept apart from its inode so the block of the inode can leave memory
+typedef struct{
+
+  int open; //1 while the file is open
+  long pos; //Seek pointer
+  long nextPos; //Position where the last read ended
+  int window; //End of the blocks already prefetched
+
+}open_file;
+
+open_file *files = NULL; //One for each inode, as the descriptor of a file is its inode
+int raBlocks = DEFAULT_READ_AHEAD; //Blocks read ahead of a sequential read
+
 /*
  * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
  * @return 	0 if success, -1 otherwise.
  */
 int mkFS(long deviceSize)
+{
+	mkfs_options options = { 0 };
+	return mkFSOptions(deviceSize, &options);
+}
+
+/*
+ * @brief 	Generates the file system structure in a storage device with the given options.
+ * @return 	0 if success, -1 otherwise.
+ */
+int mkFSOptions(long deviceSize, mkfs_options *options)
 {
 
-	//We see if the size is between the allowed values
-	if(deviceSize > MAX_SIZE_SYS_FILES || deviceSize < MIN_SIZE_SYS_FILES) return -1;
+	//We see if the size is over the minimum
+	if(deviceSize < MIN_SIZE_SYS_FILES) return -1;
 	//We stablish the number of blocks, inodes, the size and the number of blocks of data
+	long numInodes = options->inodes;
+	if(numInodes <= 0) numInodes = options->bytesPerInode > 0 ? deviceSize / options->bytesPerInode : DEFAULT_N_INODES;
+	if(numInodes <= 0 || numInodes > MAX_N_INODES) return -1;
 	sbk[0].num_Blocks = deviceSize / BLOCK_SIZE;
-	sbk[0].num_inodes = MAX_N_INODES;
+	sbk[0].num_inodes = numInodes;
 	sbk[0].size = deviceSize;
-	sbk[0].num_Blocks_Data = sbk[0].num_Blocks - 3;
-	//With bitmap_setbit we can inilizate the maps
-	for(int i=0; i<sbk[0].num_inodes; i++){ bitmap_setbit(i_map, i, 0); }
-	for(int i=0; i<sbk[0].num_Blocks_Data; i++){ bitmap_setbit(b_map, i, 0); }
-	//We write in the disk
-	if(syncFS() != 0) return -1;
-	return 0;
+	//After the superblock go the maps, sized by the device, the inodes, the name index, the journal, the checksums and the data
+	sbk[0].iMapBlock = SUPERBLOCK_BLOCK + 1;
+	sbk[0].iMapBlocks = (sbk[0].num_inodes + MAP_BITS_PER_BLOCK - 1) / MAP_BITS_PER_BLOCK;
+	sbk[0].bMapBlock = sbk[0].iMapBlock + sbk[0].iMapBlocks;
+	sbk[0].bMapBlocks = (sbk[0].num_Blocks + MAP_BITS_PER_BLOCK - 1) / MAP_BITS_PER_BLOCK;
+	sbk[0].inodeBlock = sbk[0].bMapBlock + sbk[0].bMapBlocks;
+	sbk[0].inodeBlocks = (sbk[0].num_inodes + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK;
+	//The name index has a bucket for each inode at least, a power of 2
+	sbk[0].nameBuckets = MIN_NAME_BUCKETS;
+	while(sbk[0].nameBuckets < sbk[0].num_inodes) sbk[0].nameBuckets *= 2;
+	sbk[0].nameBlock = sbk[0].inodeBlock + sbk[0].inodeBlocks;
+	sbk[0].nameBlocks = (sbk[0].nameBuckets + NAMES_PER_BLOCK - 1) / NAMES_PER_BLOCK;
+	//The journal takes an eighth of the device, within its smallest and its default size, unless it is given
+	long journalBlocks = options->journalBlocks;
+	if(journalBlocks == 0){
+
+		journalBlocks = sbk[0].num_Blocks / 8;
+		if(journalBlocks < JOURNAL_MIN_BLOCKS) journalBlocks = JOURNAL_MIN_BLOCKS;
+		if(journalBlocks > DEFAULT_JOURNAL_BLOCKS) journalBlocks = DEFAULT_JOURNAL_BLOCKS;
+
+	}
+	if(journalBlocks < JOURNAL_MIN_BLOCKS) journalBlocks = 0;
+	sbk[0].journalBlock = sbk[0].nameBlock + sbk[0].nameBlocks;
+	sbk[0].journalBlocks = journalBlocks;
+	//Each block after the journal has a checksum, so the ones of the checksums themselves go unused
+	sbk[0].crcBlock = sbk[0].journalBlock + sbk[0].journalBlocks;
+	if(sbk[0].crcBlock >= sbk[0].num_Blocks) return -1;
+	sbk[0].crcBlocks = (sbk[0].num_Blocks - sbk[0].crcBlock + CRCS_PER_BLOCK - 1) / CRCS_PER_BLOCK;
+	sbk[0].dataBlock = sbk[0].crcBlock + sbk[0].crcBlocks;
+	if(sbk[0].dataBlock >= sbk[0].num_Blocks) return -1;
+	sbk[0].checkpoint = 1;
+	sbk[0].journalStart = 0;
+	sbk[0].clean = 1;
+	sbk[0].num_Blocks_Data = sbk[0].num_Blocks - sbk[0].dataBlock;
+	//Every inode and block starts free, and the superblock and the maps have to be written
+	tableSlots = DEFAULT_INODE_CACHE;
+	if(metadataAlloc() != 0) return -1;
+	sbDirty = META_UNSAVED;
+	bitmap_setrun(iMapDirty, 0, sbk[0].iMapBlocks, 1);
+	bitmap_setrun(bMapDirty, 0, sbk[0].bMapBlocks, 1);
+	//We write in the disk, that has to be as large as the file system, with the tables empty
+	char buffer[BLOCK_SIZE];
+	if(bopen(disk) != 0){ metadataFree(); return -1; }
+	int ret = bread(disk, sbk[0].num_Blocks - 1, buffer);
+	if(ret == 0) ret = zeroBlocks(sbk[0].inodeBlock, sbk[0].inodeBlocks);
+	if(ret == 0) ret = zeroBlocks(sbk[0].nameBlock, sbk[0].nameBlocks);
+	//The journal starts empty, with nothing left in it from an older file system
+	if(ret == 0) ret = zeroBlocks(sbk[0].journalBlock, sbk[0].journalBlocks);
+	if(ret == 0) ret = syncFS();
+	if(bclose() != 0) ret = -1;
+	metadataFree();
+	return ret != 0 ? -1 : 0;
 
 }
 
@@ -53,27 +192,48 @@ int mkFS(long deviceSize)
  */
 int mountFS(void)
 {
-	//We set the bytes to 0 in the inode structure
-	for(int i=0; i<sbk[0].num_inodes; i++){ memset(&(inodo[i]), 0, sizeof(inode)); }
-	//Security copy
-	char buffer[BLOCK_SIZE];
-	memcpy(buffer, &(sbk[0]), sizeof(sbk[0]));
-	if(bread(disk, 1, (char *)&(sbk[0])) != 0) return -1;
-	//Now the same with the maps of blocks (inodes and data)
-	if(bread(disk, 1, (char*)&(i_map)) != 0) return -1;
-	if(bread(disk, 1, (char*)&(b_map)) != 0) return -1;
-	int k=0;
-	//Now we read the inodes
-	for(int i=0; i<MAX_N_INODES; i++){
+	mount_options options = { 0 };
+	return mountFSOptions(&options);
+}
+
+/*
+ * @brief 	Mounts a file system in the simulated device with the given options.
+ * @return 	0 if success, -1 otherwise.
+ */
+int mountFSOptions(mount_options *options)
+{
+	int cacheBlocks = options->cacheBlocks > 0 ? options->cacheBlocks : DEFAULT_CACHE_BLOCKS;
+	int dirtyLimit = 0;
+	if(options->writeBack){
 
-		if(i>29) k++;
-		if(bread(disk, 2+k, (char*)&(inodo[i])) != 0) return -1;
+		dirtyLimit = options->dirtyLimit > 0 ? options->dirtyLimit : DEFAULT_DIRTY_LIMIT;
+		if(dirtyLimit > cacheBlocks) dirtyLimit = cacheBlocks;
 
 	}
-
-	for(int i=0; i<MAX_N_INODES; i++){ inodo[i].state = 0; }
-	//We put the copy back
-	memcpy(&(sbk[0]), buffer, sizeof(sbk[0]));
+	raBlocks = options->readAhead != 0 ? options->readAhead : DEFAULT_READ_AHEAD;
+	if(raBlocks < 0) raBlocks = 0;
+	tableSlots = options->inodeCacheBlocks > 0 ? options->inodeCacheBlocks : DEFAULT_INODE_CACHE;
+	if(tableSlots < 2) tableSlots = 2;
+	groupCommit = options->groupCommit > 0 ? options->groupCommit : DEFAULT_GROUP_COMMIT;
+	//We open the device once for the whole session, with the cache in front of it
+	if(bopen(disk) != 0) return -1;
+	if(bbackend(options->backend) != 0 || bcache_init(cacheBlocks, dirtyLimit) != 0){ bclose(); return -1; }
+	char buffer[BLOCK_SIZE];
+	//We read the superblock, and with its geometry the maps of blocks (inodes and data)
+	if(bread(disk, SUPERBLOCK_BLOCK, buffer) != 0){ bclose(); return -1; }
+	memcpy(&(sbk[0]), buffer, sizeof(sb));
+	if(sbk[0].num_inodes == 0 || sbk[0].num_inodes > MAX_N_INODES || sbk[0].dataBlock >= sbk[0].num_Blocks || metadataAlloc() != 0){ bclose(); return -1; }
+	//After a crash, the transactions left in the journal are written in place before the maps are read
+	if(journalOpen() != 0){ metadataFree(); bclose(); return -1; }
+	//Until unmountFS, a mount finds the file system was not unmounted
+	sbk[0].clean = 0;
+	if(superblockWrite() != 0){ metadataFree(); bclose(); return -1; }
+	//The inodes and the name index are read as they are used
+	if(metadataTransfer(sbk[0].iMapBlock, sbk[0].iMapBlocks, (char *) i_map, 0) != 0 ||
+	   metadataTransfer(sbk[0].bMapBlock, sbk[0].bMapBlocks, (char *) b_map, 0) != 0){ metadataFree(); bclose(); return -1; }
+	//Without the threads, the checksums are verified by the caller alone
+	long threads = options->checksumThreads > 0 ? options->checksumThreads : sysconf(_SC_NPROCESSORS_ONLN);
+	workers_start(threads > 0 ? (int) threads : 1);
 	return 0;
 }
 
@@ -84,14 +244,15 @@ int mountFS(void)
 int unmountFS(void)
 {
 	//We check if there is any inode open
-	for(int i=0; i<sbk[0].num_inodes; i++){
-
-		if(inodo[i].state !=0) return -1;
-
-	}
-
-	//We write to the disk
+	if(openFiles > 0) return -1;
+	//We write to the disk, with nothing left in the journal, and close the device
 	if(syncFS() != 0) return -1;
+	sbk[0].clean = 1;
+	if(superblockWrite() != 0) return -1;
+	if(bclose() != 0) return -1;
+	metadataFree();
+	hashForget();
+	workers_stop();
 	return 0;
 
 }
@@ -107,17 +268,39 @@ int createFile(char *fileName)
 	if(strlen(fileName)> MAX_NAME_LENGTH) return -2;
 	//We check if we have the same file
 	if(namei(fileName)!=-1) return -1;
-	int bid = balloc();
+	if(journalReserve(JOURNAL_STEP_BLOCKS) != 0) return -2;
+	long bid = balloc();
 	int inodeid = ialloc();
 	//If there is no free inodes or blocks
-	if(bid == -1 || inodeid == -1) return -2;
+	if(bid == -1 || inodeid == -1){
+
+		//Taken in this step, the block has nothing logged to revoke
+		if(bid != -1) bfreeRun(bid, 1);
+		if(inodeid != -1) ifree(inodeid);
+		return -2;
+
+	}
 	//We add the information
-	inodo[inodeid].size = 0;
-	inodo[inodeid].block[0] = bid;
-	inodo[inodeid].pos = 0;
-	inodo[inodeid].hasIntegrity = 0;
-	inodo[inodeid].crc = 0;
-	strcpy(inodo[inodeid].name, fileName);
+	inode *file = iget(inodeid);
+	file->size = 0;
+	file->ext[0].logical = 0;
+	file->ext[0].start = bid;
+	file->ext[0].length = 1;
+	file->nExtents = 1;
+	file->blocks = 1;
+	file->hasIntegrity = 0;
+	file->crc = 0;
+	strncpy(file->name, fileName, MAX_NAME_LENGTH);
+	idirty(inodeid);
+	//Without its name the file is given back, or its inode and block would stay taken
+	if(nameInsert(inodeid) != 0){
+
+		bfree(inodeid);
+		ifree(inodeid);
+		return -2;
+
+	}
+	if(journalOperation() != 0) return -2;
 	return 0;
 
 }
@@ -133,9 +316,13 @@ int removeFile(char *fileName)
 	int i = namei(fileName);
 	if(i==-1) return -1;
 	//We check if the inode is open
-	if(inodo[i].state != 0) return -2;
-	//We free the block and the inode
-	if(bfree(i)!=0 || ifree(i)!=0) return -2;
+	inode *file = iget(i);
+	if(file == NULL || files[i].open != 0) return -2;
+	//The inode goes first and its blocks after it, so a crash in between can only leave them taken
+	inode copy = *file;
+	if(journalReserve(JOURNAL_STEP_BLOCKS) != 0 || ifree(i) != 0) return -2;
+	if(hashFree(copy.hashBlock, copy.hashDepth) != 0 || extentFree(copy.ext, copy.nExtents, copy.depth) != 0) return -2;
+	if(journalOperation() != 0) return -2;
 	return 0;
 
 }
@@ -151,8 +338,12 @@ int openFile(char *fileName)
 	int i=namei(fileName);
 	if(i==-1) return -1;
 	//We check if it's already open
-	if(inodo[i].state!=0) return -2;
-	inodo[i].state = 1; //We change the status to open
+	if(files[i].open != 0) return -2;
+	files[i].open = 1; //We change the status to open
+	files[i].pos = 0; //The seek pointer starts at the beginning
+	files[i].nextPos = 0;
+	files[i].window = 0;
+	openFiles++;
 	return i;
 
 }
@@ -164,9 +355,13 @@ int openFile(char *fileName)
 int closeFile(int fileDescriptor)
 {
 	//We check if the descriptor is valid
-	if(fileDescriptor <0 || fileDescriptor > MAX_N_INODES) return -1;
+	inode *file = fileInode(fileDescriptor);
+	if(file == NULL) return -1;
 	//We close the file
-	inodo[fileDescriptor].state = 0;
+	files[fileDescriptor].open = 0;
+	openFiles--;
+	//The changes to the metadata are committed, and blocks kept in memory by write-back reach the disk
+	if(journalCommit() != 0 || bflush() != 0) return -1;
 	return 0;
 
 }
@@ -178,61 +373,178 @@ int closeFile(int fileDescriptor)
 int readFile(int fileDescriptor, void *buffer, int numBytes)
 {
 
-	//We check if the descriptor is valid
-	if(fileDescriptor <0 || fileDescriptor > MAX_N_INODES) return -1;
-	//We need to check if the file is open
-	if(inodo[fileDescriptor].state == 0) return -1;
+	//We check if the descriptor is valid and the file is open
+	inode *file = fileInode(fileDescriptor);
+	if(file == NULL || numBytes < 0) return -1;
 	char rbf[BLOCK_SIZE]; //Char were we will put the buffer
-	int blockActual=inodo[fileDescriptor].pos/BLOCK_SIZE;
-	int start = inodo[fileDescriptor].pos;
-	int end = start + numBytes;
-	int blockF = end/BLOCK_SIZE; //The final block of lecture
-	while(blockF>5){blockF--;}
+	//If the buffer wants to read over the size of the file we need to put the end to size
+	long start = files[fileDescriptor].pos;
+	long end = start + numBytes;
+	if(end > file->size) end = file->size;
+	if(start < end) readAheadFile(fileDescriptor, start, end);
+	//Whole blocks are read straight into the buffer, the partial ones at the ends are copied from the cache
+	//or, when they cannot be borrowed, read through rbf and tbf
+	char tbf[BLOCK_SIZE];
+	block_io blocks[IO_BATCH_BLOCKS];
+	const char *view[IO_BATCH_BLOCKS];
+	long map[IO_BATCH_BLOCKS];
+	int from[IO_BATCH_BLOCKS], length[IO_BATCH_BLOCKS];
 	int total=0;
-	//If the starting point is at the end or there is no bytes to read, we return 0
-	if(start == inodo[fileDescriptor].size || numBytes == 0) return 0;
-	if(blockActual == blockF){ //Only one block to read
+	while(start + total < end){
+
+		//We find where the blocks of this batch are with a single look at the extents
+		int first = (start + total) / BLOCK_SIZE;
+		int count = (end - 1) / BLOCK_SIZE + 1 - first;
+		if(count > IO_BATCH_BLOCKS) count = IO_BATCH_BLOCKS;
+		if(bmapFile(fileDescriptor, first, count, map) != count) return -1;
+		int n=0, nio=0;
+		for(long p=start+total; p<end && n<IO_BATCH_BLOCKS; n++){
+
+			int offset = p % BLOCK_SIZE;
+			length[n] = BLOCK_SIZE - offset;
+			if(length[n] > end - p) length[n] = end - p;
+			from[n] = offset;
+			view[n] = NULL;
+			long b = map[n];
+			if(length[n] < BLOCK_SIZE) view[n] = bborrow(disk, b);
+			if(view[n] == NULL){
+
+				blocks[nio].blockNumber = b;
+				if(length[n] == BLOCK_SIZE) blocks[nio].buffer = (char *) buffer + (p - start);
+				else blocks[nio].buffer = offset > 0 ? rbf : tbf;
+				nio++;
+
+			}
+			p += length[n];
+
+		}
+		int ret = breadv(disk, blocks, nio);
+		//Every block is checked against its checksum before its bytes are given
+		for(int i=0, j=0; i<n; i++){
 
-		//If the buffer wants to read over the size of the file we need to put the end to size
-		if(end>inodo[fileDescriptor].size) end = inodo[fileDescriptor].size;
-		//Total of bytes to read
-		total = end - start;
-		bread(disk, inodo[fileDescriptor].block[blockActual], rbf); //We read the total bytes specified
-		memmove(buffer, rbf+inodo[fileDescriptor].pos, total); //We move the pointer
-		inodo[fileDescriptor].pos += end; //We stablish the new position
-		return total;
+			const char *data = view[i] != NULL ? view[i] : blocks[j++].buffer;
+			if(ret == 0 && blockCheck(fileDescriptor, first + i, map[i], data) != 0) ret = -1;
+			if(ret == 0 && length[i] < BLOCK_SIZE) memcpy((char *) buffer + total, data + from[i], length[i]);
+			if(view[i] != NULL) brelease(view[i]);
+			total += length[i];
 
-	}else{
+		}
+		if(ret != 0) return -1;
 
-		//More than one block to read
-		int p=end-start;
-		while(p>BLOCK_SIZE){ p -= BLOCK_SIZE; } //We reduce until we reach
-		for(int i=blockActual; i<=blockF; i++){
+	}
 
-			if(i==blockF){
+	files[fileDescriptor].pos += total; //We stablish the new position
+	return total;
 
-				bread(disk, inodo[fileDescriptor].block[i], rbf);
-				memmove(buffer+total, rbf, p);
-				total += p;
+}
 
-			}else{
+/*
+ * @brief	Hands out the next bytes of a file as read-only segments of the cached blocks, without copying them.
+ * @return	Number of segments filled, -1 in case of error.
+ */
+int readFileView(int fileDescriptor, file_segment *segments, int maxSegments, int numBytes)
+{
 
-				bread(disk, inodo[fileDescriptor].block[i], rbf);
-				memmove(buffer+total, rbf, BLOCK_SIZE);
-				total += BLOCK_SIZE;
+	//We check if the descriptor is valid and the file is open
+	inode *file = fileInode(fileDescriptor);
+	if(file == NULL || numBytes < 0 || maxSegments < 0) return -1;
+	long start = files[fileDescriptor].pos;
+	long end = start + numBytes;
+	if(end > file->size) end = file->size;
+	if(start < end) readAheadFile(fileDescriptor, start, end);
+	//Each segment is the part of one block inside the range, borrowed until releaseFileView
+	long map[IO_BATCH_BLOCKS];
+	int mapFirst = 0, mapped = 0;
+	int n=0;
+	long p=start;
+	while(p < end && n < maxSegments){
+
+		int offset = p % BLOCK_SIZE;
+		int length = BLOCK_SIZE - offset;
+		if(length > end - p) length = end - p;
+		//The blocks are located in batches
+		int i = p / BLOCK_SIZE;
+		if(i >= mapFirst + mapped){
+
+			int count = (end - 1) / BLOCK_SIZE + 1 - i;
+			if(count > IO_BATCH_BLOCKS) count = IO_BATCH_BLOCKS;
+			mapFirst = i;
+			mapped = bmapFile(fileDescriptor, i, count, map);
+			if(mapped <= 0) mapped = 0;
 
-			}
+		}
+		const char *block = mapped > 0 ? bborrow(disk, map[i - mapFirst]) : NULL;
+		if(block != NULL && blockCheck(fileDescriptor, i, map[i - mapFirst], block) != 0){
 
+			brelease(block);
+			block = NULL;
 
+		}
+		//When the cache has no room left for more borrowed blocks, or a block is corrupted, we hand out what we have
+		if(block == NULL){
 
+			if(n > 0) break;
+			return -1;
 
 		}
+		segments[n].data = block + offset;
+		segments[n].length = length;
+		p += length;
+		n++;
+
+	}
+
+	files[fileDescriptor].pos = p; //We stablish the new position
+	return n;
+
+}
+
+/*
+ * @brief	Gives back the blocks lent by readFileView.
+ */
+void releaseFileView(file_segment *segments, int count)
+{
+
+	for(int i=0; i<count; i++) brelease(segments[i].data);
+
+}
+
+/*
+ * @brief	Prefetches the blocks of a sequential read from start to end and the next raBlocks ones
+ * @return	0 if success, -1 otherwise.
+ */
+int readAheadFile(int fd, long start, long end)
+{
+
+	int first = start / BLOCK_SIZE;
+	int last = (end - 1) / BLOCK_SIZE;
+	//A read that does not continue the previous one restarts the detection
+	if(raBlocks == 0 || start != files[fd].nextPos){
 
-	  inodo[fileDescriptor].pos += end;
-		return total;
+		files[fd].nextPos = end;
+		files[fd].window = last + 1;
+		return 0;
 
+	}
+	files[fd].nextPos = end;
+	//While more than half of the window is still ahead of the read we wait, so the refills come in batches
+	if(files[fd].window - (last + 1) > raBlocks / 2) return 0;
+	//We ask only for the blocks not requested before, up to the end of the file
+	int nblocks = (iget(fd)->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	int from = first > files[fd].window ? first : files[fd].window;
+	int to = last + 1 + raBlocks;
+	if(to > nblocks) to = nblocks;
+	if(from >= to) return 0;
+	files[fd].window = to;
+	long map[IO_BATCH_BLOCKS];
+	while(from < to){
+
+		int count = to - from < IO_BATCH_BLOCKS ? to - from : IO_BATCH_BLOCKS;
+		if(bmapFile(fd, from, count, map) != count || bprefetch(disk, map, count) != 0) return -1;
+		from += count;
 
 	}
+	return 0;
 
 }
 
@@ -243,74 +555,114 @@ int readFile(int fileDescriptor, void *buffer, int numBytes)
 int writeFile(int fileDescriptor, void *buffer, int numBytes)
 {
 
-	//We check if the descriptor is valid
-	if(fileDescriptor <0 || fileDescriptor > MAX_N_INODES) return -1;
-	//We need to check if the file is open
-	if(inodo[fileDescriptor].state == 0) return -1;
+	//We check if the descriptor is valid and the file is open
+	inode *file = fileInode(fileDescriptor);
+	if(file == NULL || numBytes < 0) return -1;
 	char wbf[BLOCK_SIZE]; //Char were we will put the buffer
-	int start = inodo[fileDescriptor].pos;
-	int end = start + numBytes;
-		//If the buffer wants to write over the maximum size of the file we need to put a limit
-	if(end>MAX_SIZE_FILE) end = MAX_SIZE_FILE;
-	int blockI = start/BLOCK_SIZE;
-	int blockF = end/BLOCK_SIZE;
-	while(blockF>5){blockF--;}
-	//If the starting point is over the maximum file size or there is no bytes to write, we return 0
-	if(start > MAX_SIZE_FILE || numBytes == 0) return 0;
-	//Total bytes to write
-	if(blockI == blockF){
-
-		int total = end - start;
-		bread(disk, inodo[fileDescriptor].block[blockI], wbf); //We read the total bytes specified
-		memmove(wbf, (char *) buffer, total); //We move the pointer
-		bwrite(disk, inodo[fileDescriptor].block[blockI], wbf); //We write on the file
-		inodo[fileDescriptor].size += total; //We update the size of the file
-		inodo[fileDescriptor].pos += end; //We stablish the new position
-		return total;
-
-	}else{
-
-		int total=0;
-		int p=end-start; while(p>BLOCK_SIZE){ p-=BLOCK_SIZE; }
-		for(int i=blockI; i<blockF; i++){
-
-			if(i>blockI){
-
-				int b=balloc();
-				if(b==-1) return -1;
-				inodo[fileDescriptor].block[i]= b;
-
-			}
-
-			if(i==blockF-1){
+	long start = files[fileDescriptor].pos;
+	long end = start + numBytes;
+	//If the buffer wants to write over the maximum size of the file we need to put a limit
+	if(end > MAX_SIZE_FILE) end = MAX_SIZE_FILE;
+	if(end <= start) return 0;
+	//The first block is allocated at creation, the rest when we reach them, in runs as long as possible
+	int needed = (end - 1) / BLOCK_SIZE + 1;
+	if((int) file->blocks < needed && extendFile(fileDescriptor, needed - file->blocks) < 0) return -1;
+	int allocated = file->blocks;
+	block_io blocks[IO_BATCH_BLOCKS];
+	long map[IO_BATCH_BLOCKS];
+	uint32_t crcs[IO_BATCH_BLOCKS];
+	//Blocks skipped by a seek past the end are filled with zeros
+	int hole = start / BLOCK_SIZE < allocated ? start / BLOCK_SIZE : allocated;
+	memset(wbf, 0, BLOCK_SIZE);
+	uint32_t zeroCrc = CRC32C((unsigned char *) wbf, BLOCK_SIZE);
+	for(int z=(int) ((file->size + BLOCK_SIZE - 1) / BLOCK_SIZE); z<hole; ){
+
+		int count = hole - z < IO_BATCH_BLOCKS ? hole - z : IO_BATCH_BLOCKS;
+		if(journalReserve(JOURNAL_STEP_BLOCKS) != 0 || bmapFile(fileDescriptor, z, count, map) != count) return -1;
+		for(int k=0; k<count; k++){
+
+			blocks[k].blockNumber = map[k];
+			blocks[k].buffer = wbf;
 
-				memset(wbf, 0, BLOCK_SIZE);
-				bread(disk, inodo[fileDescriptor].block[i], wbf); //We read the total bytes specified
-				memmove(wbf, (char *) buffer, p); //We move the pointer
-				bwrite(disk, inodo[fileDescriptor].block[i], wbf);
-				total += p;
-				inodo[fileDescriptor].size += p; //We update the size of the file
+		}
+		if(bwritev(disk, blocks, count) != 0) return -1;
+		for(int k=0; k<count; k++){
 
-			}else{
+			crcs[k] = zeroCrc;
+			if(sumStore(map[k], zeroCrc) != 0) return -1;
 
-				memset(wbf, 0, BLOCK_SIZE);
-				bread(disk, inodo[fileDescriptor].block[i], wbf); //We read the total bytes specified
-				memmove(wbf, (char *) buffer, BLOCK_SIZE); //We move the pointer
-				bwrite(disk, inodo[fileDescriptor].block[i], wbf);
-				total += BLOCK_SIZE;
-				inodo[fileDescriptor].size += BLOCK_SIZE; //We update the size of the file
+		}
+		if(file->hashBlock != 0 && hashUpdate(fileDescriptor, z, count, crcs) != 0) return -1;
+		z += count;
 
+	}
+	//Without free blocks we write what fits in the ones we have
+	if(end > (long) allocated * BLOCK_SIZE) end = (long) allocated * BLOCK_SIZE;
+	if(end <= start) return -1;
+	//Whole blocks are written straight from the buffer, the partial ones at the ends through wbf and tbf
+	char tbf[BLOCK_SIZE];
+	int total=0;
+	while(start + total < end){
+
+		int base = (start + total) / BLOCK_SIZE;
+		int nmap = (end - 1) / BLOCK_SIZE + 1 - base;
+		if(nmap > IO_BATCH_BLOCKS) nmap = IO_BATCH_BLOCKS;
+		//Each batch is a step of its own, with the checksums and the size it changes
+		if(journalReserve(JOURNAL_STEP_BLOCKS) != 0 || bmapFile(fileDescriptor, base, nmap, map) != nmap) break;
+		int n=0, count=0;
+		for(long p=start+total; p<end && n<IO_BATCH_BLOCKS; n++){
+
+			int i = p / BLOCK_SIZE;
+			long first = (long) i * BLOCK_SIZE;
+			int offset = p % BLOCK_SIZE;
+			int length = BLOCK_SIZE - offset;
+			if(length > end - p) length = end - p;
+			blocks[n].blockNumber = map[i - base];
+			blocks[n].buffer = (char *) buffer + (p - start);
+			//Partial blocks are completed with their current content, served by the cache
+			if(length < BLOCK_SIZE){
+
+				char *pbf = offset > 0 ? wbf : tbf;
+				memset(pbf, 0, BLOCK_SIZE);
+				if(first < file->size){
+
+					if(bread(disk, map[i - base], pbf) != 0 || blockCheck(fileDescriptor, i, map[i - base], pbf) != 0){ n = -1; break; }
+					if(file->size - first < BLOCK_SIZE) memset(pbf + (file->size - first), 0, BLOCK_SIZE - (file->size - first));
+
+				}
+				memcpy(pbf + offset, (char *) buffer + (p - start), length);
+				blocks[n].buffer = pbf;
 
 			}
+			p += length;
+			count += length;
+
+		}
+		if(n < 0 || bwritev(disk, blocks, n) != 0) break;
+		//The checksums follow the blocks written, and the hash tree of the file when it has one
+		int k=0;
+		for(; k<n; k++){
 
+			crcs[k] = CRC32C((unsigned char *) blocks[k].buffer, BLOCK_SIZE);
+			if(sumStore(blocks[k].blockNumber, crcs[k]) != 0) break;
 
 		}
+		if(k < n || (file->hashBlock != 0 && hashUpdate(fileDescriptor, base, n, crcs) != 0)) break;
+		total += count;
+		//We update the size of the file, the position alone is not saved
+		if(start + total > (long) file->size){
 
-		inodo[fileDescriptor].pos += end; //We stablish the new position
-		return total;
+			file->size = start + total;
+			idirty(fileDescriptor);
+
+		}
 
 	}
 
+	files[fileDescriptor].pos += total; //We stablish the new position
+	if(journalOperation() != 0 || total == 0) return -1;
+	return total;
+
 }
 
 /*
@@ -323,24 +675,25 @@ int lseekFile(int fileDescriptor, long offset, int whence)
 	//We need to see if the offset is on an allowed range
 	if(offset > MAX_SIZE_FILE || offset < 0) return -1;
 	//The inode must be open
-	if(inodo[fileDescriptor].state==0) return -1;
+	inode *file = fileInode(fileDescriptor);
+	if(file == NULL) return -1;
 	switch(whence){
 
 		case FS_SEEK_CUR: //We add the offset to the actual position
 
 			//Case where the offset and the actual position is greater than the maximum size allowed
-			if(inodo[fileDescriptor].pos + offset > MAX_SIZE_FILE) return -1;
-			inodo[fileDescriptor].pos += offset;
+			if(files[fileDescriptor].pos + offset > MAX_SIZE_FILE) return -1;
+			files[fileDescriptor].pos += offset;
 			break;
 
 		case FS_SEEK_END: //We put the pointer to the end
 
-			inodo[fileDescriptor].pos = inodo[fileDescriptor].size;
+			files[fileDescriptor].pos = file->size;
 			break;
 
 		case FS_SEEK_BEGIN: //We put the pointer to the start
 
-			inodo[fileDescriptor].pos = 0;
+			files[fileDescriptor].pos = 0;
 			break;
 
 	}
@@ -357,7 +710,7 @@ int lseekFile(int fileDescriptor, long offset, int whence)
 int checkFile (char * fileName)
 {
 	// If file is open and has been modified, it will always detect corruption.
-	// To get the contents of the file, we choosed to use readFile
+	// The CRC comes from the checksums of the blocks, each block read is checked against its own
 
 	// If the file isnt opened, it opens it and closes it at the end
 	int of_result;
@@ -366,29 +719,15 @@ int checkFile (char * fileName)
 
 	if (of_result == -1 || file_inode_n == -1) return -2; // File doesnt exist
 
-	// Put the position on the start of the file and then put it back
-	inode* file_inode = &inodo[file_inode_n];
+	inode* file_inode = iget(file_inode_n);
 
 	// Check first if the file has integrity
 	if (file_inode->hasIntegrity == 0) return -2;
 
-	unsigned int orig_inode_pos = file_inode->pos;
-	unsigned int file_length = file_inode->size;
-	file_inode->pos = 0;
-
-	// Read the entire file
-	unsigned char file_data[file_length];
-	readFile(file_inode_n, file_data, file_length);
-
-	// Calculate and compare the CRC
-	uint32_t new_crc = CRC32(file_data, file_length);
-	uint32_t stored_crc = file_inode->crc;
-
+	// Calculate and compare the CRC, a block that does not match its checksum is corruption too
+	uint32_t new_crc;
 	int result = 0;
-	if ( new_crc != stored_crc ) result = -1;	// File is corrupted
-
-	// Put back the original inode position
-	file_inode->pos = orig_inode_pos;
+	if ( fileCrc(file_inode_n, 1, &new_crc) != 0 || new_crc != file_inode->crc ) result = -1;	// File is corrupted
 
 	if (of_result >= 0) closeFile(of_result); // If file wasnt originaly open, it closes it again
 
@@ -402,7 +741,7 @@ int checkFile (char * fileName)
 
 int includeIntegrity (char * fileName)
 {
-	// To get the contents of the file, we choosed to use readFile
+	// The CRC is combined from the checksums of the blocks, so the file is not read
 
 	// If the file isnt opened, it opens it and closes it at the end
 	int of_result;
@@ -411,27 +750,29 @@ int includeIntegrity (char * fileName)
 
 	if (of_result == -1 || file_inode_n == -1) return -1; // File doesnt exist
 
-	// Put the position on the start of the file and then put it back
-	inode* file_inode = &inodo[file_inode_n];
-	unsigned int orig_inode_pos = file_inode->pos;
-	unsigned int file_length = file_inode->size;
-	file_inode->pos = 0;
-
-	// Read the entire file
-	unsigned char file_data[file_length];
-	readFile(file_inode_n, file_data, file_length);
-
-	// Calculate and store the CRC
-	uint32_t new_crc = CRC32(file_data, file_length);
-	file_inode->crc = new_crc;
-	file_inode->hasIntegrity = 1;
-
-	// Put back the original inode position
-	file_inode->pos = orig_inode_pos;
+	// The hash tree is made once, then every write keeps it up to date. Until the file has integrity it may be unfinished
+	int result = 0;
+	inode* file_inode = iget(file_inode_n);
+	if (file_inode->hasIntegrity == 0 && hashBuild(file_inode_n) != 0) result = -2;
+
+	// Calculate and store the CRC, from the sums of the hash tree
+	uint32_t new_crc;
+	if (result == 0 && fileCrc(file_inode_n, 0, &new_crc) == 0) {
+		// Without room in the journal the inode is left as it was
+		if (journalReserve(1) != 0) result = -2;
+		else {
+			file_inode = iget(file_inode_n);
+			file_inode->crc = new_crc;
+			file_inode->hasIntegrity = 1;
+			idirty(file_inode_n);
+			if (journalOperation() != 0) result = -2;
+		}
+	}
+	else result = -2;
 
 	if (of_result >= 0) closeFile(of_result); // If file wasnt originaly open, it closes it again
 
-    return 0;
+    return result;
 }
 
 /*
@@ -441,11 +782,21 @@ int includeIntegrity (char * fileName)
 int openFileIntegrity(char *fileName)
 {
 	// The file must have integrity first
-	if ( inodo[namei(fileName)].hasIntegrity == 0 ) return -3;
-
-	int cf_result = checkFile(fileName);
-	if ( cf_result == -1 ) return -2; // File is corrupted
-	else if ( cf_result == -2 ) return -3; // Other check error
+	int file_inode_n = namei(fileName);
+	if ( file_inode_n == -1 ) return -1; // File doesnt exist
+	inode *file = iget(file_inode_n);
+	if ( file == NULL ) return -3;
+	if ( file->hasIntegrity == 0 ) return -3;
+
+	// With a hash tree the blocks are checked as they are read, so only the way down to the first leaf is checked now
+	if ( file->hashBlock != 0 ) {
+		if ( hashLeaf(file_inode_n, 0) == NULL ) return -2; // File is corrupted
+	}
+	else {
+		int cf_result = checkFile(fileName);
+		if ( cf_result == -1 ) return -2; // File is corrupted
+		else if ( cf_result == -2 ) return -3; // Other check error
+	}
 
 	int of_result = openFile(fileName);
 	if ( of_result == -1 ) return -1; // File doesnt exist
@@ -461,9 +812,10 @@ int openFileIntegrity(char *fileName)
 int closeFileIntegrity(int fileDescriptor)
 {
 	// The file must have integrity first
-	if ( inodo[fileDescriptor].hasIntegrity == 0 ) return -1;
+	inode *file = fileInode(fileDescriptor);
+	if ( file == NULL || file->hasIntegrity == 0 ) return -1;
 
-	if (includeIntegrity(inodo[fileDescriptor].name) != 0) return -1;
+	if (includeIntegrity(file->name) != 0) return -1;
 	if (closeFile(fileDescriptor) != 0) return -1;
 
     return 0;
@@ -488,13 +840,13 @@ int createLn(char *fileName, char *linkName)
 		of_result = openFile(SYMLINK_FILE);
 	}
 
-	char links_buffer[MAX_FILE_SIZE];
-	if (readFile(of_result, links_buffer, MAX_FILE_SIZE) == -1) return -2;
+	char links_buffer[MAX_SIZE_LINKS];
+	if (readFile(of_result, links_buffer, MAX_SIZE_LINKS) == -1) return -2;
 
 	int end_file_pointer = strlen(links_buffer);
 
 	// If it doesnt fit in the file, return error
-	if ( (end_file_pointer + strlen(linkName) + 2) >= MAX_SIZE_FILE ) {
+	if ( (end_file_pointer + strlen(linkName) + 2) >= MAX_SIZE_LINKS ) {
 		return -2;
 	}
 
@@ -531,11 +883,11 @@ int removeLn(char *linkName)
 		return -1;
 	}
 
-	char *links_buffer=malloc(MAX_SIZE_FILE);
+	char *links_buffer=malloc(MAX_SIZE_LINKS);
 	lseekFile(of_result, 0, FS_SEEK_BEGIN);
-	if (readFile(of_result, links_buffer, MAX_FILE_SIZE) == -1) return -2;
-	char ** tok = malloc(MAX_SIZE_FILE);
-	char ** amp = malloc(MAX_SIZE_FILE);
+	if (readFile(of_result, links_buffer, MAX_SIZE_LINKS) == -1) return -2;
+	char ** tok = malloc(MAX_SIZE_LINKS);
+	char ** amp = malloc(MAX_SIZE_LINKS);
 	int i=0;
 	int k=0;
 	const char * pipe="|";
@@ -562,7 +914,7 @@ int removeLn(char *linkName)
 
 
 	}
-	char * new = malloc(MAX_SIZE_FILE);
+	char * new = malloc(MAX_SIZE_LINKS);
 	for(int j=0; j<k; j++){
 
 		if(strcmp(amp[j], "")!=0){
@@ -586,129 +938,1678 @@ int removeLn(char *linkName)
 }
 
 /*
- * @brief 	Writes data on disk
- * @return 	0 if it's written correctly, -1 if there is case of error
+ * @brief 	Prepares the cache of a table of blocks blocks from first, with every slot empty
+ * @return 	0 if it works, -1 in case of error
  */
-int syncFS(void){
-
-	char a[BLOCK_SIZE];
-	memset(a, 0x0, BLOCK_SIZE);
-	char b[BLOCK_SIZE];
-	memset(a, 0x0, BLOCK_SIZE);
-	char c[BLOCK_SIZE];
-	memset(a, 0x0, BLOCK_SIZE);
-	//We write the superblock
-	char buffer[BLOCK_SIZE];
-	memcpy(buffer, &(sbk[0]), sizeof(sbk[0]));
-	memmove(&(sbk[0]), a, sizeof(sb));
-	memcpy(&(sbk[0]), buffer, sizeof(sbk[0]));
-	memmove(&(i_map), a, sizeof(sb));
-	memmove(&(b_map), a, sizeof(sb));
-	if(bwrite(disk, 1, a) != 0) return -1;
-	//Now the same for blocks of maps (data and inodes)
-	memmove(&(inodo[0]), b, 29*sizeof(inode));
-	memmove(&(inodo[29]), c, 19*sizeof(inode));
-	//Now we write the inodes into the disk
-	if(bwrite(disk, 2, b)) return -1;
-	if(bwrite(disk, 3, c)) return -1;
+static int tableAlloc(table_cache *table, long first, long blocks, int slots){
+
+	table->first = first;
+	table->blocks = blocks;
+	table->slots = slots;
+	table->clock = 0;
+	table->data = calloc(slots, sizeof(char *));
+	table->block = malloc(slots * sizeof(long));
+	table->used = calloc(slots, sizeof(unsigned long));
+	table->dirty = calloc(slots, 1);
+	table->slot = malloc(blocks * sizeof(int));
+	if(table->data == NULL || table->block == NULL || table->used == NULL || table->dirty == NULL || table->slot == NULL) return -1;
+	for(int j=0; j<slots; j++) if((table->data[j] = malloc(BLOCK_SIZE)) == NULL) return -1;
+	for(int j=0; j<slots; j++) table->block[j] = -1;
+	for(long k=0; k<blocks; k++) table->slot[k] = -1;
 	return 0;
 
 }
 
+static void tableFree(table_cache *table){
+
+	for(int j=0; table->data != NULL && j<table->slots; j++) free(table->data[j]);
+	free(table->data);
+	free(table->block);
+	free(table->used);
+	free(table->dirty);
+	free(table->slot);
+	memset(table, 0, sizeof(table_cache));
+
+}
+
 /*
- * @brief 	Search for a free inode
- * @return 	i if we found a free inode, -1 if there isn't free inodes
+ * @brief 	Adds a slot to a table, for when the changes in every slot wait for the commit
+ * @return 	The slot, -1 in case of error
  */
-int ialloc(void){
+static int tableGrow(table_cache *table){
+
+	int j = table->slots;
+	char **data = realloc(table->data, (j + 1) * sizeof(char *));
+	if(data != NULL) table->data = data;
+	long *block = realloc(table->block, (j + 1) * sizeof(long));
+	if(block != NULL) table->block = block;
+	unsigned long *used = realloc(table->used, (j + 1) * sizeof(unsigned long));
+	if(used != NULL) table->used = used;
+	char *dirty = realloc(table->dirty, j + 1);
+	if(dirty != NULL) table->dirty = dirty;
+	if(data == NULL || block == NULL || used == NULL || dirty == NULL || (table->data[j] = malloc(BLOCK_SIZE)) == NULL) return -1;
+	table->block[j] = -1;
+	table->used[j] = 0;
+	table->dirty[j] = 0;
+	table->slots++;
+	return j;
+
+}
+
+/*
+ * @brief 	Gives the block k of a table, reading it if it is not in memory. To make room, the slot
+ *		used longest ago is reused, written back first if it changed. A slot with changes not yet
+ *		logged can't leave memory before the commit, so when there is no other the table grows
+ * @return 	The copy of the block, NULL in case of error. loaded is set when the block was read
+ *		from the disk
+ */
+static char *tableBlock(table_cache *table, long k, int *loaded){
 
-	for(int i=0; i<MAX_N_INODES; i++){
+	*loaded = 0;
+	int j = table->slot[k];
+	if(j == -1){
 
-		//We search for a free inode
-		if(bitmap_getbit(i_map, i)==0){
+		//We choose the victim among the slots that were logged, or all of them without a journal
+		for(int v=0; v<table->slots; v++){
 
-			//Inode changes his status to OCUPIED
-			bitmap_setbit(i_map, i, 1);
-			memset(&(inodo[i]), 0, sizeof(inode));
-			return i;
+			if(journal.blocks != 0 && (table->dirty[v] & META_UNLOGGED)) continue;
+			if(j == -1 || table->used[v] < table->used[j]) j = v;
 
 		}
+		if(j == -1 && (j = tableGrow(table)) == -1) return NULL;
+		char *block = table->data[j];
+		if(table->block[j] != -1){
 
+			if((table->dirty[j] & META_UNSAVED) && bwrite(disk, table->first + table->block[j], block) != 0) return NULL;
+			table->dirty[j] = 0;
+			table->slot[table->block[j]] = -1;
+			table->block[j] = -1;
+
+		}
+		if(bread(disk, table->first + k, block) != 0) return NULL;
+		table->block[j] = k;
+		table->slot[k] = j;
+		*loaded = 1;
 
 	}
+	table->used[j] = ++table->clock;
+	return table->data[j];
 
-	return -1;
+}
+
+/*
+ * @brief 	Marks the block k of a table, that has to be in memory, as changed
+ */
+static void tableDirty(table_cache *table, long k){
+
+	int j = table->slot[k];
+	if(j == -1) return;
+	if(!(table->dirty[j] & META_UNLOGGED)) journal.pending++;
+	table->dirty[j] = META_UNSAVED | META_UNLOGGED;
 
 }
 
 /*
- * @brief 	Search for a free blocks
- * @return 	i if we found a free block, -1 if there isn't free blocks
+ * @brief 	Adds the blocks of a table with some of the changes in mask to a list of blocks to write,
+ *		and clears those changes
+ * @return 	The blocks in the list
+ */
+static int tableCollect(table_cache *table, int mask, block_io *blocks, int n){
+
+	for(int j=0; j<table->slots; j++){
+
+		if(!(table->dirty[j] & mask)) continue;
+		blocks[n].blockNumber = table->first + table->block[j];
+		blocks[n].buffer = table->data[j];
+		table->dirty[j] &= ~mask;
+		n++;
+
+	}
+	return n;
+
+}
+
+/*
+ * @brief 	Marks the blocks of a map holding count bits from bit as changed
+ */
+static void mapDirty(uint64_t *dirty, uint64_t *log, long bit, long count){
+
+	for(long k=bit / MAP_BITS_PER_BLOCK; k<=(bit + count - 1) / MAP_BITS_PER_BLOCK; k++){
+
+		if(!bitmap_getbit(log, k)) journal.pending++;
+		bitmap_setbit(log, k, 1);
+		bitmap_setbit(dirty, k, 1);
+
+	}
+
+}
+
+/*
+ * @brief 	Adds the changed blocks of a map to a list of blocks to write, and marks them as written
+ * @return 	The blocks in the list
  */
-int balloc(void){
+static int mapCollect(uint64_t *map, uint64_t *dirty, long first, long blocks, block_io *list, int n){
 
-	char bk[BLOCK_SIZE];
-	for(int i=0; i<sbk[0].num_Blocks_Data; i++){
+	for(long w=0; w<(long) BITMAP_WORDS(blocks); w++){
 
-		//We search for a free block
-		if(bitmap_getbit(b_map, i)==0){
+		while(dirty[w] != 0){
 
-			//Block changes his status to OCUPIED
-			bitmap_setbit(b_map, i, 1);
-			memset(&(bk[i]), 0, BLOCK_SIZE);
-			return i;
+			long k = w * 64 + __builtin_ctzll(dirty[w]);
+			dirty[w] &= dirty[w] - 1;
+			list[n].blockNumber = first + k;
+			list[n].buffer = (char *) map + k * BLOCK_SIZE;
+			n++;
 
 		}
 
 	}
+	return n;
 
-	return -1;
+}
+
+/*
+ * @brief 	Counts the blocks marked in a map of changed blocks
+ * @return 	The count
+ */
+static long dirtyCount(uint64_t *dirty, long blocks){
+
+	long n=0;
+	for(long w=0; w<(long) BITMAP_WORDS(blocks); w++) n += __builtin_popcountll(dirty[w]);
+	return n;
 
 }
 
 /*
- * @brief	Searches for a inode with the fileName provided
- * @return	i if we find the inode, -1 in case there is no file with that name
+ * @brief 	Fills count blocks of the disk from first with zeros, in batches
+ * @return 	0 if it works, -1 in case of error
  */
-int namei(char *fileName)
-{
+static int zeroBlocks(long first, long count){
+
+	char *zeros = calloc(METADATA_BATCH, BLOCK_SIZE);
+	if(zeros == NULL) return -1;
+	block_io blocks[METADATA_BATCH];
+	int ret = 0;
+	for(long done=0; done<count && ret == 0; ){
+
+		int n=0;
+		for(; n<METADATA_BATCH && done<count; n++, done++){
 
-	for(int i=0; i<MAX_N_INODES; i++){
+			blocks[n].blockNumber = first + done;
+			blocks[n].buffer = zeros + (long) n * BLOCK_SIZE;
 
-		if(strncmp(inodo[i].name, fileName, strlen(fileName)) == 0) return i;
+		}
+		ret = bwritev(disk, blocks, n);
 
 	}
+	free(zeros);
+	return ret;
 
-	return -1;
+}
+
+/*
+ * @brief 	Writes the superblock in its place and waits for the device
+ * @return 	0 if it works, -1 in case of error
+ */
+static int superblockWrite(void){
+
+	char buffer[BLOCK_SIZE];
+	memset(buffer, 0, BLOCK_SIZE);
+	memcpy(buffer, &(sbk[0]), sizeof(sb));
+	if(bwrite(disk, SUPERBLOCK_BLOCK, buffer) != 0 || bsync() != 0) return -1;
+	return 0;
 
 }
 
 /*
- * @brief	frees an inode
- * @return	0 if it works, -1 in case of error
+ * @brief 	Empties the journal once its blocks are in their place, moving the checkpoint of the
+ *		superblock to the next transaction
+ * @return 	0 if it works, -1 in case of error
  */
-int ifree(int i){
+static int journalCheckpoint(void){
+
+	sbk[0].checkpoint = journal.sequence;
+	sbk[0].journalStart = journal.head;
+	if(superblockWrite() != 0) return -1;
+	journal.start = journal.head;
+	journal.used = 0;
+	journal.nLogged = 0;
+	return 0;
 
-	if(i<0 || i>MAX_N_INODES) return -1;
-	memset(&(inodo[i]), 0, sizeof(inode));
-	bitmap_setbit(i_map, i, 0);
+}
+
+/*
+ * @brief 	Writes in their place every metadata block changed, with a single call. With a journal,
+ *		they reach the device before the journal is emptied
+ * @return 	0 if it works, -1 in case of error
+ */
+static int metadataSave(void){
+
+	long count = (sbDirty & META_UNSAVED) + dirtyCount(iMapDirty, sbk[0].iMapBlocks) + dirtyCount(bMapDirty, sbk[0].bMapBlocks);
+	for(int j=0; j<inodes.slots; j++) count += (inodes.dirty[j] & META_UNSAVED) != 0;
+	for(int j=0; j<names.slots; j++) count += (names.dirty[j] & META_UNSAVED) != 0;
+	for(int j=0; j<sums.slots; j++) count += (sums.dirty[j] & META_UNSAVED) != 0;
+	//With nothing to write in place and the journal empty there is nothing to wait for
+	if(count == 0 && journal.used == 0) return bflush();
+	if(count > 0){
+
+		block_io *blocks = malloc(count * sizeof(block_io));
+		if(blocks == NULL) return -1;
+		char buffer[BLOCK_SIZE];
+		int n=0;
+		if(sbDirty & META_UNSAVED){
+
+			//We put the superblock in its block
+			memset(buffer, 0x0, sizeof(buffer));
+			memcpy(buffer, &(sbk[0]), sizeof(sb));
+			blocks[n].blockNumber = SUPERBLOCK_BLOCK;
+			blocks[n].buffer = buffer;
+			n++;
+
+		}
+		//The maps are written straight from memory
+		n = mapCollect(i_map, iMapDirty, sbk[0].iMapBlock, sbk[0].iMapBlocks, blocks, n);
+		n = mapCollect(b_map, bMapDirty, sbk[0].bMapBlock, sbk[0].bMapBlocks, blocks, n);
+		n = tableCollect(&inodes, META_UNSAVED, blocks, n);
+		n = tableCollect(&names, META_UNSAVED, blocks, n);
+		n = tableCollect(&sums, META_UNSAVED, blocks, n);
+		int ret = bwritev(disk, blocks, n);
+		free(blocks);
+		if(ret != 0) return -1;
+		sbDirty &= ~META_UNSAVED;
+
+	}
+	if(journal.blocks == 0) return bflush();
+	if(bsync() != 0) return -1;
+	return journal.used > 0 ? journalCheckpoint() : 0;
+
+}
+
+/*
+ * @brief 	Writes in their place the blocks of extent trees kept until the commit
+ * @return 	0 if it works, -1 in case of error
+ */
+static int journalExtraSave(void){
+
+	block_io blocks[METADATA_BATCH];
+	for(int done=0; done<journal.nExtra; ){
+
+		int n=0;
+		for(; n<METADATA_BATCH && done<journal.nExtra; n++, done++){
+
+			blocks[n].blockNumber = journal.extra[done];
+			blocks[n].buffer = journal.extraData + (long) done * BLOCK_SIZE;
+
+		}
+		if(bwritev(disk, blocks, n) != 0) return -1;
+
+	}
+	journal.nExtra = 0;
+	return 0;
+
+}
+
+/*
+ * @brief 	Commits to the journal, as one transaction, every metadata block changed since the last
+ *		commit. When the journal gets half full its blocks are written in their place and it is
+ *		emptied. The steps reserve their room first, so the transaction always fits
+ * @return 	0 if it works, -1 in case of error or if the transaction does not fit
+ */
+int journalCommit(void){
+
+	journal.ops = 0;
+	if(journal.blocks == 0){
+
+		//Without journal, the changes wait for syncFS
+		if(iMapLog != NULL){
+
+			memset(iMapLog, 0, BITMAP_WORDS(sbk[0].iMapBlocks) * sizeof(uint64_t));
+			memset(bMapLog, 0, BITMAP_WORDS(sbk[0].bMapBlocks) * sizeof(uint64_t));
+
+		}
+		for(int j=0; j<inodes.slots; j++) inodes.dirty[j] &= ~META_UNLOGGED;
+		for(int j=0; j<names.slots; j++) names.dirty[j] &= ~META_UNLOGGED;
+		for(int j=0; j<sums.slots; j++) sums.dirty[j] &= ~META_UNLOGGED;
+		sbDirty &= ~META_UNLOGGED;
+		journal.pending = 0;
+		return 0;
+
+	}
+	long count = journal.pending;
+	if(count == 0) return 0;
+	//Written in place, the blocks of a transaction too large would not reach the disk all or none
+	if(count > JOURNAL_TXN_BLOCKS || count + 1 > journal.blocks - journal.used) return -1;
+	//The descriptor goes first, then the blocks, all of them in the ring
+	block_io *blocks = malloc((count + 1) * sizeof(block_io));
+	if(blocks == NULL) return -1;
+	journal_block descriptor;
+	char buffer[BLOCK_SIZE];
+	int n=1;
+	if(sbDirty & META_UNLOGGED){
+
+		memset(buffer, 0x0, sizeof(buffer));
+		memcpy(buffer, &(sbk[0]), sizeof(sb));
+		blocks[n].blockNumber = SUPERBLOCK_BLOCK;
+		blocks[n].buffer = buffer;
+		n++;
+
+	}
+	n = mapCollect(i_map, iMapLog, sbk[0].iMapBlock, sbk[0].iMapBlocks, blocks, n);
+	n = mapCollect(b_map, bMapLog, sbk[0].bMapBlock, sbk[0].bMapBlocks, blocks, n);
+	n = tableCollect(&inodes, META_UNLOGGED, blocks, n);
+	n = tableCollect(&names, META_UNLOGGED, blocks, n);
+	n = tableCollect(&sums, META_UNLOGGED, blocks, n);
+	for(int k=0; k<journal.nExtra; k++, n++){
+
+		blocks[n].blockNumber = journal.extra[k];
+		blocks[n].buffer = journal.extraData + (long) k * BLOCK_SIZE;
+
+	}
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.txn.hdr.magic = JOURNAL_MAGIC;
+	descriptor.txn.hdr.count = n - 1;
+	descriptor.txn.hdr.revokes = journal.nRevoked;
+	descriptor.txn.hdr.sequence = journal.sequence;
+	for(int k=0; k<journal.nRevoked; k++) descriptor.txn.entry[n - 1 + k].block = journal.revoked[k];
+	for(int k=1; k<n; k++){
+
+		descriptor.txn.entry[k-1].block = blocks[k].blockNumber;
+		descriptor.txn.entry[k-1].crc = CRC32((unsigned char *) blocks[k].buffer, BLOCK_SIZE);
+		blocks[k].blockNumber = journal.first + (journal.head + k) % journal.blocks;
+
+	}
+	descriptor.txn.hdr.crc = CRC32((unsigned char *) descriptor.data, BLOCK_SIZE);
+	blocks[0].blockNumber = journal.first + journal.head;
+	blocks[0].buffer = descriptor.data;
+	//Once the transaction is in the device, its blocks can be written in place
+	int ret = bwritev(disk, blocks, n);
+	free(blocks);
+	if(ret != 0 || bsync() != 0) return -1;
+	sbDirty &= ~META_UNLOGGED;
+	journal.pending = 0;
+	journal.nRevoked = 0;
+	//Until the checkpoint, a replay writes the tree blocks of this transaction again
+	for(int k=0; k<journal.nExtra; k++){
+
+		long l=0;
+		while(l < journal.nLogged && journal.logged[l] != journal.extra[k]) l++;
+		if(l == journal.nLogged) journal.logged[journal.nLogged++] = journal.extra[k];
+
+	}
+	journal.head = (journal.head + n) % journal.blocks;
+	journal.used += n;
+	journal.sequence++;
+	if(journalExtraSave() != 0) return -1;
+	if(journal.used > journal.blocks / 2) return metadataSave();
 	return 0;
 
+}
+
+/*
+ * @brief 	Counts an operation that changed the metadata, committing a group of them when it is full
+ *		or when the changes fill half of the room left in the journal
+ * @return 	0 if it works, -1 in case of error
+ */
+int journalOperation(void){
+
+	if(++journal.ops >= groupCommit || journal.pending > JOURNAL_TXN_BLOCKS / 2 ||
+	   journal.pending + 1 > (journal.blocks - journal.used) / 2) return journalCommit();
+	return 0;
 
 }
 
 /*
- * @brief	frees a block
- * @return	0 if it works, -1 in case of error
+ * @brief 	Makes room in the transaction for a step of an operation that changes up to count metadata
+ *		blocks, committing the steps before it if they would not fit together. A step is never split
+ *		between transactions, so the journal always brings the file system to the end of a step
+ * @return 	0 if it works, -1 in case of error or if the step does not fit in the journal
  */
-int bfree(int i){
+static int journalReserve(long count){
+
+	if(journal.blocks == 0) return 0;
+	long room = journal.blocks - journal.used - 1;
+	if(room > JOURNAL_TXN_BLOCKS) room = JOURNAL_TXN_BLOCKS;
+	if(journal.pending + count <= room) return 0;
+	if(journalCommit() != 0) return -1;
+	//Once committed, the blocks can go to their place to empty the ring
+	if(count + 1 > journal.blocks - journal.used && metadataSave() != 0) return -1;
+	return count <= JOURNAL_TXN_BLOCKS && count + 1 <= journal.blocks ? 0 : -1;
 
-for(int j=0; j<5; j++){
+}
+
+/*
+ * @brief 	Reads a block of an extent tree, from the changes waiting for the commit if it is there
+ * @return 	0 if it works, -1 in case of error
+ */
+int metaRead(long block, char *buffer){
 
-	if(inodo[i].block[j]>sbk[0].num_Blocks_Data) return -1;
-		bitmap_setbit(b_map, inodo[i].block[j], 0);
+	for(int k=0; k<journal.nExtra; k++){
+
+		if(journal.extra[k] != block) continue;
+		memcpy(buffer, journal.extraData + (long) k * BLOCK_SIZE, BLOCK_SIZE);
+		return 0;
 
 	}
+	return bread(disk, block, buffer);
+
+}
+
+/*
+ * @brief 	Writes a block of an extent tree. With a journal it is kept until the commit logs it
+ * @return 	0 if it works, -1 in case of error
+ */
+int metaWrite(long block, char *buffer){
+
+	if(journal.blocks == 0) return bwrite(disk, block, buffer);
+	int k=0;
+	while(k < journal.nExtra && journal.extra[k] != block) k++;
+	if(k == journal.nExtra){
+
+		if(k == journal.maxExtra){
+
+			int max = journal.maxExtra > 0 ? journal.maxExtra * 2 : 16;
+			long *extra = realloc(journal.extra, max * sizeof(long));
+			if(extra != NULL) journal.extra = extra;
+			char *data = realloc(journal.extraData, (size_t) max * BLOCK_SIZE);
+			if(data != NULL) journal.extraData = data;
+			if(extra == NULL || data == NULL) return -1;
+			journal.maxExtra = max;
+
+		}
+		journal.extra[k] = block;
+		journal.nExtra++;
+		journal.pending++;
 
+	}
+	memcpy(journal.extraData + (long) k * BLOCK_SIZE, buffer, BLOCK_SIZE);
 	return 0;
 
 }
+
+/*
+ * @brief 	Reads the transaction of the journal that starts at pos, with left blocks of the ring after it,
+ *		and its blocks into data, checking it is the one of that sequence and that it is complete
+ * @return 	Blocks of the ring it takes, 0 if it is not there or not complete, -1 in case of error
+ */
+static long journalRead(long pos, long left, uint64_t sequence, journal_block *descriptor, char *data){
+
+	long ring = sbk[0].journalBlocks;
+	block_io blocks[JOURNAL_TXN_BLOCKS];
+	if(bread(disk, sbk[0].journalBlock + pos, descriptor->data) != 0) return -1;
+	uint32_t crc = descriptor->txn.hdr.crc;
+	descriptor->txn.hdr.crc = 0;
+	long count = descriptor->txn.hdr.count;
+	long entries = count + descriptor->txn.hdr.revokes;
+	if(descriptor->txn.hdr.magic != JOURNAL_MAGIC || descriptor->txn.hdr.sequence != sequence ||
+	   CRC32((unsigned char *) descriptor->data, BLOCK_SIZE) != crc ||
+	   entries <= 0 || entries > JOURNAL_TXN_BLOCKS || count + 1 > left) return 0;
+	for(int k=0; k<count; k++){
+
+		blocks[k].blockNumber = sbk[0].journalBlock + (pos + 1 + k) % ring;
+		blocks[k].buffer = data + (long) k * BLOCK_SIZE;
+
+	}
+	if(breadv(disk, blocks, count) != 0) return -1;
+	//A block that does not match its descriptor means the transaction was not finished
+	for(int k=0; k<entries; k++){
+
+		if(descriptor->txn.entry[k].block >= sbk[0].num_Blocks) return 0;
+		if(k < count && CRC32((unsigned char *) blocks[k].buffer, BLOCK_SIZE) != descriptor->txn.entry[k].crc) return 0;
+
+	}
+	return count + 1;
+
+}
+
+/*
+ * @brief 	Starts the journal of a mounted file system. After a clean unmountFS it is empty, otherwise
+ *		the transactions after the checkpoint are written in place. A first pass finds the complete
+ *		ones and the blocks they revoke, then the second one writes every block logged that was not
+ *		revoked by a later transaction. The replay stops at the first transaction that is
+ *		not complete, and never reads more than the journal
+ * @return 	0 if it works, -1 in case of error
+ */
+static int journalOpen(void){
+
+	journal.blocks = 0;
+	if(sbk[0].journalBlocks == 0) return 0;
+	if(sbk[0].journalStart >= sbk[0].journalBlocks) return -1;
+	long ring = sbk[0].journalBlocks;
+	long pos = sbk[0].journalStart;
+	uint64_t sequence = sbk[0].checkpoint;
+	long done = 0;
+	int ret = 0;
+	journal.logged = malloc(ring * sizeof(long));
+	journal.revoked = malloc(JOURNAL_TXN_BLOCKS * sizeof(long));
+	if(journal.logged == NULL || journal.revoked == NULL) return -1;
+	if(!sbk[0].clean){
+
+		journal_block descriptor;
+		char *data = malloc((size_t) JOURNAL_TXN_BLOCKS * BLOCK_SIZE);
+		block_io *blocks = malloc(JOURNAL_TXN_BLOCKS * sizeof(block_io));
+		//Each block revoked, with the last transaction that revokes it
+		long *revoked = NULL;
+		uint64_t *revokedBy = NULL;
+		long nRevoked = 0;
+		if(data == NULL || blocks == NULL) ret = -1;
+		while(ret == 0 && done < ring){
+
+			long taken = journalRead(pos, ring - done, sequence, &descriptor, data);
+			if(taken <= 0){ ret = taken; break; }
+			long count = descriptor.txn.hdr.count;
+			long entries = count + descriptor.txn.hdr.revokes;
+			for(long k=count; k<entries; k++){
+
+				long r=0;
+				while(r < nRevoked && revoked[r] != (long) descriptor.txn.entry[k].block) r++;
+				if(r == nRevoked){
+
+					long *more = realloc(revoked, (nRevoked + 1) * sizeof(long));
+					if(more != NULL) revoked = more;
+					uint64_t *moreBy = realloc(revokedBy, (nRevoked + 1) * sizeof(uint64_t));
+					if(moreBy != NULL) revokedBy = moreBy;
+					if(more == NULL || moreBy == NULL){ ret = -1; break; }
+					revoked[nRevoked++] = descriptor.txn.entry[k].block;
+
+				}
+				revokedBy[r] = sequence;
+
+			}
+			pos = (pos + taken) % ring;
+			done += taken;
+			sequence++;
+
+		}
+		//The same transactions again, now writing their blocks
+		pos = sbk[0].journalStart;
+		for(uint64_t s=sbk[0].checkpoint; ret == 0 && s<sequence; s++){
+
+			long taken = journalRead(pos, ring, s, &descriptor, data);
+			if(taken <= 0){ ret = -1; break; }
+			int n=0;
+			for(long k=0; k<(long) descriptor.txn.hdr.count; k++){
+
+				long r=0;
+				while(r < nRevoked && revoked[r] != (long) descriptor.txn.entry[k].block) r++;
+				//A copy logged again after the revoke, in the same transaction, is the one to keep
+				if(r < nRevoked && revokedBy[r] > s) continue;
+				blocks[n].blockNumber = descriptor.txn.entry[k].block;
+				blocks[n].buffer = data + k * BLOCK_SIZE;
+				n++;
+
+			}
+			if(bwritev(disk, blocks, n) != 0) ret = -1;
+			pos = (pos + taken) % ring;
+
+		}
+		free(data);
+		free(blocks);
+		free(revoked);
+		free(revokedBy);
+		if(ret != 0) return -1;
+
+	}
+	journal.first = sbk[0].journalBlock;
+	journal.blocks = ring;
+	journal.start = journal.head = pos;
+	journal.used = 0;
+	journal.sequence = sequence;
+	if(done > 0){
+
+		//The superblock may have come in a transaction, with an older checkpoint
+		char buffer[BLOCK_SIZE];
+		if(bsync() != 0 || bread(disk, SUPERBLOCK_BLOCK, buffer) != 0) return -1;
+		memcpy(&(sbk[0]), buffer, sizeof(sb));
+		sbk[0].checkpoint = sequence;
+		sbk[0].journalStart = pos;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Writes data on disk
+ * @return 	0 if it's written correctly, -1 if there is case of error
+ */
+int syncFS(void){
+
+	//The changes are committed first, so writing them in place can be undone by the replay
+	if(journalCommit() != 0) return -1;
+	//Only the metadata blocks that changed are written, all of them with a single call
+	return metadataSave();
+
+}
+
+/*
+ * @brief 	Reads or writes count consecutive metadata blocks, from first, from or to memory, in batches
+ * @return 	0 if it works, -1 in case of error
+ */
+int metadataTransfer(long first, long count, char *memory, int write){
+
+	block_io blocks[METADATA_BATCH];
+	for(long done=0; done<count; ){
+
+		int n=0;
+		for(; n<METADATA_BATCH && done<count; n++, done++){
+
+			blocks[n].blockNumber = first + done;
+			blocks[n].buffer = memory + done * BLOCK_SIZE;
+
+		}
+		if((write ? bwritev(disk, blocks, n) : breadv(disk, blocks, n)) != 0) return -1;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Allocates the maps with the sizes in the superblock, free, and the caches of the tables, empty
+ * @return 	0 if it works, -1 in case of error
+ */
+int metadataAlloc(void){
+
+	metadataFree();
+	i_map = calloc(sbk[0].iMapBlocks, BLOCK_SIZE);
+	b_map = calloc(sbk[0].bMapBlocks, BLOCK_SIZE);
+	iMapDirty = calloc(BITMAP_WORDS(sbk[0].iMapBlocks), sizeof(uint64_t));
+	bMapDirty = calloc(BITMAP_WORDS(sbk[0].bMapBlocks), sizeof(uint64_t));
+	iMapLog = calloc(BITMAP_WORDS(sbk[0].iMapBlocks), sizeof(uint64_t));
+	bMapLog = calloc(BITMAP_WORDS(sbk[0].bMapBlocks), sizeof(uint64_t));
+	files = calloc(sbk[0].num_inodes, sizeof(open_file));
+	if(i_map == NULL || b_map == NULL || iMapDirty == NULL || bMapDirty == NULL || iMapLog == NULL || bMapLog == NULL || files == NULL ||
+	   tableAlloc(&inodes, sbk[0].inodeBlock, sbk[0].inodeBlocks, tableSlots) != 0 ||
+	   tableAlloc(&names, sbk[0].nameBlock, sbk[0].nameBlocks, tableSlots) != 0 ||
+	   tableAlloc(&sums, sbk[0].crcBlock, sbk[0].crcBlocks, tableSlots) != 0){
+
+		metadataFree();
+		return -1;
+
+	}
+	iHint = bHint = 0;
+	sbDirty = 0;
+	openFiles = 0;
+	return 0;
+
+}
+
+/*
+ * @brief 	Frees the maps and the tables
+ */
+void metadataFree(void){
+
+	free(i_map);
+	free(b_map);
+	free(iMapDirty);
+	free(bMapDirty);
+	free(iMapLog);
+	free(bMapLog);
+	free(files);
+	i_map = b_map = iMapDirty = bMapDirty = iMapLog = bMapLog = NULL;
+	files = NULL;
+	tableFree(&inodes);
+	tableFree(&names);
+	tableFree(&sums);
+	free(journal.extra);
+	free(journal.extraData);
+	free(journal.logged);
+	free(journal.revoked);
+	memset(&journal, 0, sizeof(journal));
+
+}
+
+/*
+ * @brief 	Gives an inode, reading its block of the table if it is not in memory. The inode may leave
+ *		memory with the next call for another one, open or not
+ * @return 	The inode, NULL in case of error
+ */
+inode *iget(int i){
+
+	int fresh;
+	char *block = tableBlock(&inodes, i / INODES_PER_BLOCK, &fresh);
+	if(block == NULL) return NULL;
+	return (inode *) (block + (i % INODES_PER_BLOCK) * sizeof(inode));
+
+}
+
+/*
+ * @brief 	Marks an inode, that has to be in memory, as changed so syncFS saves it
+ */
+void idirty(int i){
+
+	tableDirty(&inodes, i / INODES_PER_BLOCK);
+
+}
+
+/*
+ * @brief 	Gives the inode of an open file
+ * @return 	The inode, NULL if the descriptor is not valid or the file is not open
+ */
+inode *fileInode(int fileDescriptor){
+
+	if(i_map == NULL || fileDescriptor < 0 || fileDescriptor >= sbk[0].num_inodes || files[fileDescriptor].open == 0) return NULL;
+	return iget(fileDescriptor);
+
+}
+
+/*
+ * @brief 	Search for a free inode
+ * @return 	i if we found a free inode, -1 if there isn't free inodes
+ */
+int ialloc(void){
+
+	//We search for a free inode from the last one allocated, and it changes his status to OCUPIED
+	long i = bitmap_alloc(i_map, sbk[0].num_inodes, &iHint);
+	if(i == -1) return -1;
+	inode *file = iget(i);
+	if(file == NULL){
+
+		bitmap_setbit(i_map, i, 0);
+		return -1;
+
+	}
+	mapDirty(iMapDirty, iMapLog, i, 1);
+	memset(file, 0, sizeof(inode));
+	idirty(i);
+	return i;
+
+}
+
+/*
+ * @brief 	Search for a free blocks
+ * @return 	i if we found a free block, -1 if there isn't free blocks
+ */
+long balloc(void){
+
+	//We search for a free block from the last one allocated, and it changes his status to OCUPIED
+	long i = bitmap_alloc(b_map, sbk[0].num_Blocks_Data, &bHint);
+	if(i == -1) return -1;
+	mapDirty(bMapDirty, bMapLog, i, 1);
+	return sbk[0].dataBlock + i;
+
+}
+
+/*
+ * @brief 	Search for count free blocks one after the other
+ * @return 	The first block of the run, -1 if there isn't a free run that long
+ */
+long balloc_n(int count){
+
+	long i = bitmap_alloc_run(b_map, sbk[0].num_Blocks_Data, count, &bHint);
+	if(i == -1) return -1;
+	mapDirty(bMapDirty, bMapLog, i, count);
+	return sbk[0].dataBlock + i;
+
+}
+
+/*
+ * @brief 	Counts the tree blocks logged since the checkpoint among count blocks from the block b,
+ *		each of them needs an entry of the transaction to be revoked when it is freed
+ * @return 	Number of entries
+ */
+static long bfreeRevokes(long b, long count){
+
+	long revokes = 0;
+	for(long k=0; k<journal.nLogged; k++) revokes += journal.logged[k] >= b && journal.logged[k] < b + count;
+	return revokes;
+
+}
+
+/*
+ * @brief 	Gives back count blocks one after the other, from the block b of the device
+ * @return 	0 if it works, -1 if the transaction has no room to revoke them, leaving them taken
+ */
+int bfreeRun(long b, long count){
+
+	if(journal.nRevoked + bfreeRevokes(b, count) > JOURNAL_TXN_BLOCKS) return -1;
+	long i = b - sbk[0].dataBlock;
+	bitmap_setrun(b_map, i, count, 0);
+	mapDirty(bMapDirty, bMapLog, i, count);
+	//Tree blocks waiting for the commit are dropped, or they would overwrite the next use of the block
+	for(int k=0; k<journal.nExtra; ){
+
+		if(journal.extra[k] < b || journal.extra[k] >= b + count){ k++; continue; }
+		journal.nExtra--;
+		journal.extra[k] = journal.extra[journal.nExtra];
+		memcpy(journal.extraData + (long) k * BLOCK_SIZE, journal.extraData + (long) journal.nExtra * BLOCK_SIZE, BLOCK_SIZE);
+
+	}
+	//For the same reason the ones already logged are revoked, so a replay skips them
+	for(long k=0; k<journal.nLogged; ){
+
+		if(journal.logged[k] < b || journal.logged[k] >= b + count){ k++; continue; }
+		journal.revoked[journal.nRevoked++] = journal.logged[k];
+		journal.pending++;
+		journal.logged[k] = journal.logged[--journal.nLogged];
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Gives back count blocks one after the other from the block b of a file being removed, in a step
+ *		for each block of the map they change, so a crash can only leave some of them taken
+ * @return 	0 if it works, -1 in case of error
+ */
+static int bfreeSteps(long b, long count){
+
+	while(count > 0){
+
+		long n = MAP_BITS_PER_BLOCK - (b - sbk[0].dataBlock) % MAP_BITS_PER_BLOCK;
+		if(n > count) n = count;
+		//The block of the map, and an entry for each block that has to be revoked
+		if(journalReserve(1 + bfreeRevokes(b, n)) != 0 || bfreeRun(b, n) != 0) return -1;
+		b += n;
+		count -= n;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Keeps the CRC32C of a data block in the checksums, that are saved with the rest of the metadata
+ * @return 	0 if it works, -1 in case of error
+ */
+static int sumStore(long b, uint32_t crc){
+
+	int fresh;
+	long k = b - sbk[0].dataBlock;
+	uint32_t *block = (uint32_t *) tableBlock(&sums, k / CRCS_PER_BLOCK, &fresh);
+	if(block == NULL) return -1;
+	//A block written again with the same content leaves the checksums as they were
+	if(block[k % CRCS_PER_BLOCK] == crc) return 0;
+	block[k % CRCS_PER_BLOCK] = crc;
+	tableDirty(&sums, k / CRCS_PER_BLOCK);
+	return 0;
+
+}
+
+/*
+ * @brief 	Gives the checksum of a data block
+ * @return 	0 if it works, -1 in case of error
+ */
+static int sumLoad(long b, uint32_t *crc){
+
+	int fresh;
+	long k = b - sbk[0].dataBlock;
+	uint32_t *block = (uint32_t *) tableBlock(&sums, k / CRCS_PER_BLOCK, &fresh);
+	if(block == NULL) return -1;
+	*crc = block[k % CRCS_PER_BLOCK];
+	return 0;
+
+}
+
+//Last leaf of a hash tree verified, valid while no tree changes
+struct{
+
+  int fd; //Inode of the tree, -1 if there is none
+  int leaf;
+  unsigned long generation; //Value of hashGeneration when it was verified
+  hash_block block;
+
+}hashCache = { -1, 0, 0, { { 0 } } };
+unsigned long hashGeneration = 0; //Changes of any hash tree so far
+
+/*
+ * @brief	Drops the leaf verified last, whose device may change before the next mount.
+ */
+static void hashForget(void)
+{
+	hashCache.fd = -1;
+}
+
+/*
+ * @brief 	Blocks of the file covered by a hash tree of the given depth
+ */
+static long hashSpan(int depth){
+
+	long span = HASH_LEAF_ENTRIES;
+	for(int d=0; d<depth; d++) span *= HASH_NODE_ENTRIES;
+	return span;
+
+}
+
+/*
+ * @brief 	Reads a leaf of the hash tree of a file, checking every block on the way down against the
+ *		CRC32C kept above it, up to the root in the inode
+ * @return 	The leaf, NULL if the tree does not match or in case of error
+ */
+static const uint32_t *hashLeaf(int fd, int leaf){
+
+	if(hashCache.fd == fd && hashCache.leaf == leaf && hashCache.generation == hashGeneration) return hashCache.block.leaf;
+	inode *file = iget(fd);
+	if(file == NULL || (long) leaf * HASH_LEAF_ENTRIES >= hashSpan(file->hashDepth)) return NULL;
+	hashCache.fd = -1;
+	uint64_t b = file->hashBlock;
+	uint32_t crc = file->hashRoot;
+	for(int d=file->hashDepth; ; d--){
+
+		if(b == 0 || metaRead(b, hashCache.block.data) != 0) return NULL;
+		if(CRC32C((unsigned char *) hashCache.block.data, BLOCK_SIZE) != crc) return NULL;
+		if(d == 0) break;
+		hash_entry *entry = &hashCache.block.node[((long) leaf * HASH_LEAF_ENTRIES / hashSpan(d - 1)) % HASH_NODE_ENTRIES];
+		b = entry->block;
+		crc = entry->crc;
+
+	}
+	hashCache.fd = fd;
+	hashCache.leaf = leaf;
+	hashCache.generation = hashGeneration;
+	return hashCache.block.leaf;
+
+}
+
+/*
+ * @brief 	Appends to ctx the checksums of the first count blocks of a file, taken from its hash tree. The
+ *		subtrees they cover whole give their sum, so only the blocks on the way to the last one are
+ *		read, each checked against the CRC32C kept above it
+ * @return 	0 if it works, -1 if the tree does not match or in case of error
+ */
+static int hashCombine(int fd, long count, crc32c_ctx *ctx){
+
+	inode *file = iget(fd);
+	if(file == NULL || count > hashSpan(file->hashDepth)) return -1;
+	hash_block node;
+	uint64_t b = file->hashBlock;
+	uint32_t crc = file->hashRoot;
+	long base = 0;
+	for(int d=file->hashDepth; base < count; d--){
+
+		if(b == 0 || metaRead(b, node.data) != 0) return -1;
+		if(CRC32C((unsigned char *) node.data, BLOCK_SIZE) != crc) return -1;
+		if(d == 0){
+
+			for(long k=0; k<count - base; k++) CRC32C_append(ctx, node.leaf[k], BLOCK_SIZE);
+			break;
+
+		}
+		long span = hashSpan(d - 1);
+		int j = 0;
+		for(; base + span <= count; j++, base += span) CRC32C_append(ctx, node.node[j].sum, (uint64_t) span * BLOCK_SIZE);
+		if(base == count) break;
+		b = node.node[j].block;
+		crc = node.node[j].crc;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Sets the checksums of the blocks [first, first + count) of a file in the subtree of the given
+ *		depth that starts at *b and covers the blocks from base, making the blocks it lacks. Every
+ *		block changed is rewritten, *crc takes the new CRC32C of the subtree and *sum its new sum.
+ *		The sum is linear in the checksums, so it changes by the changed ones alone, moved by the
+ *		length of the blocks after them
+ * @return 	0 if it works, -1 in case of error
+ */
+static int hashSet(uint64_t *b, uint32_t *crc, uint32_t *sum, int depth, long base, long first, int count, const uint32_t *crcs){
+
+	hash_block node;
+	if(*b == 0){
+
+		long nb = balloc();
+		if(nb < 0) return -1;
+		memset(node.data, 0, BLOCK_SIZE);
+		*b = nb;
+
+	}
+	else if(metaRead(*b, node.data) != 0) return -1;
+	uint32_t delta = 0;
+	long after = 0;
+	for(int k=0; depth==0 && k<count; k++){
+
+		delta = CRC32C_combine(delta, node.leaf[first - base + k] ^ crcs[k], BLOCK_SIZE);
+		node.leaf[first - base + k] = crcs[k];
+		after = (base + HASH_LEAF_ENTRIES - first - k - 1) * BLOCK_SIZE;
+
+	}
+	for(long f=first; depth>0 && f<first+count; ){
+
+		long span = hashSpan(depth - 1);
+		int j = (f - base) / span;
+		long n = base + (j + 1) * span - f;
+		if(n > first + count - f) n = first + count - f;
+		uint32_t old = node.node[j].sum;
+		if(hashSet(&node.node[j].block, &node.node[j].crc, &node.node[j].sum, depth - 1, base + j * span, f, n, crcs + (f - first)) != 0) return -1;
+		delta = CRC32C_combine(delta, old ^ node.node[j].sum, (uint64_t) span * BLOCK_SIZE);
+		after = (uint64_t) (HASH_NODE_ENTRIES - 1 - j) * span * BLOCK_SIZE;
+		f += n;
+
+	}
+	*sum ^= CRC32C_combine(delta, 0, after);
+	*crc = CRC32C((unsigned char *) node.data, BLOCK_SIZE);
+	return metaWrite(*b, node.data);
+
+}
+
+/*
+ * @brief 	Sets the checksums of count blocks of a file from first in its hash tree, that grows a level
+ *		on top each time the file outgrows it
+ * @return 	0 if it works, -1 in case of error
+ */
+static int hashUpdate(int fd, int first, int count, const uint32_t *crcs){
+
+	inode *file = iget(fd);
+	if(file == NULL) return -1;
+	hashGeneration++;
+	while(first + count > hashSpan(file->hashDepth)){
+
+		if(file->hashBlock != 0){
+
+			hash_block top;
+			long nb = balloc();
+			if(nb < 0) return -1;
+			memset(top.data, 0, BLOCK_SIZE);
+			top.node[0].block = file->hashBlock;
+			top.node[0].crc = file->hashRoot;
+			top.node[0].sum = file->hashSum;
+			if(metaWrite(nb, top.data) != 0) return -1;
+			file->hashBlock = nb;
+			file->hashRoot = CRC32C((unsigned char *) top.data, BLOCK_SIZE);
+			//The old tree is the first of the entries, the rest are empty
+			file->hashSum = CRC32C_combine(file->hashSum, 0, (uint64_t) (HASH_NODE_ENTRIES - 1) * hashSpan(file->hashDepth) * BLOCK_SIZE);
+
+		}
+		file->hashDepth++;
+
+	}
+	int ret = hashSet(&file->hashBlock, &file->hashRoot, &file->hashSum, file->hashDepth, 0, first, count, crcs);
+	idirty(fd);
+	return ret;
+
+}
+
+/*
+ * @brief 	Makes the hash tree of an open file from the checksums of its blocks, over the tree it has if
+ *		a crash stopped an earlier one, in steps of a batch each
+ * @return 	0 if it works, -1 in case of error
+ */
+static int hashBuild(int fd){
+
+	inode *file = fileInode(fd);
+	if(file == NULL) return -1;
+	int blocks = (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	long map[CHECK_BATCH_BLOCKS];
+	uint32_t crcs[CHECK_BATCH_BLOCKS];
+	//An empty file gets its top block too, so the tree follows every write from now on
+	if(journalReserve(JOURNAL_STEP_BLOCKS) != 0 || hashUpdate(fd, 0, 0, crcs) != 0) return -1;
+	for(int i=0; i<blocks; ){
+
+		int count = blocks - i < CHECK_BATCH_BLOCKS ? blocks - i : CHECK_BATCH_BLOCKS;
+		if(journalReserve(JOURNAL_STEP_BLOCKS) != 0 || bmapFile(fd, i, count, map) != count) return -1;
+		for(int k=0; k<count; k++) if(sumLoad(map[k], &crcs[k]) != 0) return -1;
+		if(hashUpdate(fd, i, count, crcs) != 0) return -1;
+		i += count;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief 	Frees the blocks of a subtree of a hash tree
+ * @return 	0 if it works, -1 in case of error
+ */
+static int hashFree(uint64_t b, int depth){
+
+	hashGeneration++;
+	if(b == 0) return 0;
+	if(b < sbk[0].dataBlock || b >= sbk[0].num_Blocks) return -1;
+	if(depth > 0){
+
+		hash_block node;
+		if(metaRead(b, node.data) != 0) return -1;
+		for(int j=0; j<HASH_NODE_ENTRIES; j++) if(hashFree(node.node[j].block, depth - 1) != 0) return -1;
+
+	}
+	return bfreeSteps(b, 1);
+
+}
+
+/*
+ * @brief 	Compares the content of the block i of a file, in the block b of the device, with its checksum
+ *		and, when the file has a hash tree, with the checksum in the tree
+ * @return 	0 if they match, -1 if the block is corrupted or in case of error
+ */
+static int blockCheck(int fd, int i, long b, const char *data){
+
+	uint32_t crc, sum;
+	crc = CRC32C((const unsigned char *) data, BLOCK_SIZE);
+	if(sumLoad(b, &sum) != 0 || sum != crc) return -1;
+	inode *file = iget(fd);
+	if(file == NULL) return -1;
+	if(file->hashBlock == 0) return 0;
+	const uint32_t *leaf = hashLeaf(fd, i / HASH_LEAF_ENTRIES);
+	if(leaf == NULL || leaf[i % HASH_LEAF_ENTRIES] != crc) return -1;
+	return 0;
+
+}
+
+//Blocks read by fileCrc, verified in parallel by the workers
+typedef struct{
+
+  const char *data; //Blocks read
+  const uint32_t *sums; //Checksum of each block
+  int count; //Blocks
+  int tasks; //Parts they are split into, one for each task
+  uint32_t crc[MAX_WORKERS]; //CRC32C of the blocks of each part together
+  int bad[MAX_WORKERS]; //Blocks of each part that do not match their checksum
+
+}check_job;
+
+/*
+ * @brief 	Task of the workers: checks the blocks of a part of a check_job and combines their CRC32C
+ */
+static void checkTask(void *arg, int t){
+
+	check_job *job = (check_job *) arg;
+	int first = (long) job->count * t / job->tasks;
+	int last = (long) job->count * (t + 1) / job->tasks;
+	crc32c_ctx ctx;
+	int bad = 0;
+	CRC32C_init(&ctx);
+	for(int k=first; k<last; k++){
+
+		uint32_t c = CRC32C((const unsigned char *) job->data + (long) k * BLOCK_SIZE, BLOCK_SIZE);
+		bad += c != job->sums[k];
+		CRC32C_append(&ctx, c, BLOCK_SIZE);
+
+	}
+	job->crc[t] = CRC32C_final(&ctx);
+	job->bad[t] = bad;
+
+}
+
+/*
+ * @brief 	Computes the CRC32C of the content of an open file by combining the checksums of its blocks,
+ *		so only the last block is read, when it is partial. With verify every block is also read
+ *		and checked against its checksum, by the workers in parallel
+ * @return 	0 if it works, -1 if a block is corrupted or in case of error
+ */
+int fileCrc(int fd, int verify, uint32_t *crc){
+
+	inode *file = fileInode(fd);
+	if(file == NULL) return -1;
+	long size = file->size;
+	int full = size / BLOCK_SIZE;
+	int rest = size % BLOCK_SIZE;
+	char buffer[BLOCK_SIZE];
+	block_io blocks[CHECK_BATCH_BLOCKS];
+	long map[CHECK_BATCH_BLOCKS];
+	uint32_t sums[CHECK_BATCH_BLOCKS];
+	check_job job;
+	char *data = NULL;
+	if(verify && full > 0 && (data = malloc((size_t) CHECK_BATCH_BLOCKS * BLOCK_SIZE)) == NULL) return -1;
+	//The CRC runs over the file in order, each block given by its checksum and the last one by its bytes
+	crc32c_ctx ctx;
+	int ret = 0;
+	CRC32C_init(&ctx);
+	//Without reading, the hash tree gives the whole blocks at the cost of the way to the last one
+	int i = 0;
+	if(!verify && file->hashBlock != 0){
+
+		if(hashCombine(fd, full, &ctx) != 0) ret = -1;
+		i = full;
+
+	}
+	while(i<full && ret==0){
+
+		int count = full - i < CHECK_BATCH_BLOCKS ? full - i : CHECK_BATCH_BLOCKS;
+		if(bmapFile(fd, i, count, map) != count){ ret = -1; break; }
+		for(int k=0; k<count && ret==0; k++) ret = sumLoad(map[k], &sums[k]);
+		//The checksums have to match the hash tree of the file too, when it has one
+		for(int k=0; verify && file->hashBlock != 0 && k<count && ret==0; k++){
+
+			const uint32_t *leaf = hashLeaf(fd, (i + k) / HASH_LEAF_ENTRIES);
+			if(leaf == NULL || leaf[(i + k) % HASH_LEAF_ENTRIES] != sums[k]) ret = -1;
+
+		}
+		if(ret != 0) break;
+		i += count;
+		if(!verify){
+
+			for(int k=0; k<count; k++) CRC32C_append(&ctx, sums[k], BLOCK_SIZE);
+			continue;
+
+		}
+		//Each worker checks a part of the blocks read and gives the CRC32C of its part
+		for(int k=0; k<count; k++){
+
+			blocks[k].blockNumber = map[k];
+			blocks[k].buffer = data + (long) k * BLOCK_SIZE;
+
+		}
+		if(breadv(disk, blocks, count) != 0){ ret = -1; break; }
+		job.data = data;
+		job.sums = sums;
+		job.count = count;
+		job.tasks = count / CHECK_TASK_BLOCKS;
+		if(job.tasks > workers_count()) job.tasks = workers_count();
+		if(job.tasks < 1) job.tasks = 1;
+		workers_run(checkTask, &job, job.tasks);
+		for(int t=0; t<job.tasks; t++){
+
+			long blocksInTask = (long) count * (t + 1) / job.tasks - (long) count * t / job.tasks;
+			if(job.bad[t] != 0) ret = -1;
+			CRC32C_append(&ctx, job.crc[t], blocksInTask * BLOCK_SIZE);
+
+		}
+
+	}
+	free(data);
+	if(ret != 0) return -1;
+	//The checksum of the last block covers the zeros after the end, so its bytes are read
+	if(rest > 0){
+
+		if(bmapFile(fd, full, 1, map) != 1) return -1;
+		if(bread(disk, map[0], buffer) != 0 || blockCheck(fd, full, map[0], buffer) != 0) return -1;
+		CRC32C_update(&ctx, (unsigned char *) buffer, rest);
+
+	}
+	*crc = CRC32C_final(&ctx);
+	return 0;
+
+}
+
+/*
+ * @brief	Searches by halves the last of n entries, sorted by their first block, that starts at or before block
+ * @return	Its position
+ */
+static int extentSearch(extent *ext, int n, unsigned int block)
+{
+
+	int lo = 0, hi = n;
+	while(hi - lo > 1){
+
+		int mid = (lo + hi) / 2;
+		if(ext[mid].logical <= block) lo = mid;
+		else hi = mid;
+
+	}
+	return lo;
+
+}
+
+/*
+ * @brief	Gives the entries of a level of the extent tree of a file, the inode for level 0 and path for the rest
+ * @return	The entries
+ */
+static extent *extentLevel(inode *file, extent_block *path, int level, unsigned int **count, int *max)
+{
+
+	if(level == 0){
+
+		*count = &(file->nExtents);
+		*max = INODE_EXTENTS;
+		return file->ext;
+
+	}
+	*count = &(path[level-1].node.hdr.count);
+	*max = EXTENTS_PER_BLOCK;
+	return path[level-1].node.ext;
+
+}
+
+/*
+ * @brief	Finds the blocks of the device that hold count blocks of a file, starting at its block first
+ * @return	Number of blocks found, fewer if the file ends before, -1 in case of error
+ */
+int bmapFile(int fd, int first, int count, long *blocks)
+{
+
+	inode *file = iget(fd);
+	extent_block node;
+	int n=0;
+	if(first < 0) return -1;
+	while(n < count && (unsigned int) (first + n) < file->blocks){
+
+		//We go down from the inode to the extents holding the block, a search by halves in each level
+		unsigned int block = first + n;
+		extent *ext = file->ext;
+		int entries = file->nExtents;
+		for(int d=file->depth; d>0; d--){
+
+			long child = ext[extentSearch(ext, entries, block)].start;
+			if(metaRead(child, node.data) != 0) return -1;
+			ext = node.node.ext;
+			entries = node.node.hdr.count;
+
+		}
+		//We take the blocks of the following extents of that leaf
+		int found = n;
+		for(int k=extentSearch(ext, entries, block); k<entries && n<count; k++){
+
+			for(unsigned int b = first + n - ext[k].logical; b < ext[k].length && n < count; b++) blocks[n++] = ext[k].start + b;
+
+		}
+		if(n == found) return -1;
+
+	}
+	return n;
+
+}
+
+/*
+ * @brief	Finds the lowest level of the last branch of the extent tree of a file with room for one more entry
+ * @return	The level, -1 if they are all full
+ */
+static int extentRoom(inode *file, extent_block *path)
+{
+
+	unsigned int *count;
+	int max;
+	for(int level=file->depth; level>=0; level--){
+
+		extentLevel(file, path, level, &count, &max);
+		if(*count < (unsigned int) max) return level;
+
+	}
+	return -1;
+
+}
+
+/*
+ * @brief	Adds an extent at the end of a file, creating the blocks of the tree it needs, given the branch
+ *		that ends in its last extent (path, the blocks of path and the ones changed)
+ * @return	The new extent, NULL if there is no room for it
+ */
+static extent *extentAppend(inode *file, extent_block *path, long *pathBlock, char *dirty)
+{
+
+	unsigned int *count;
+	int max;
+	//The lowest level of the branch with room takes the new entry, if none the tree grows one level
+	int level = extentRoom(file, path);
+	if(level < 0){
+
+		//The entries of the inode move to a new block below it
+		if(file->depth == EXTENT_MAX_DEPTH) return NULL;
+		long b = balloc();
+		if(b == -1) return NULL;
+		memmove(&(path[1]), &(path[0]), file->depth * sizeof(extent_block));
+		memmove(&(pathBlock[2]), &(pathBlock[1]), file->depth * sizeof(long));
+		memmove(&(dirty[2]), &(dirty[1]), file->depth);
+		path[0].node.hdr.count = file->nExtents;
+		path[0].node.hdr.depth = file->depth;
+		memcpy(path[0].node.ext, file->ext, file->nExtents * sizeof(extent));
+		pathBlock[1] = b;
+		dirty[1] = 1;
+		file->ext[0].logical = 0;
+		file->ext[0].start = b;
+		file->ext[0].length = 0;
+		file->nExtents = 1;
+		file->depth++;
+		level = extentRoom(file, path);
+
+	}
+	//Below it we start a new branch, with a block for each level
+	long fresh[EXTENT_MAX_DEPTH + 1];
+	for(int l=level+1; l<=(int) file->depth; l++){
+
+		fresh[l] = balloc();
+		if(fresh[l] == -1){
+
+			//Taken in this step, the blocks have nothing logged to revoke
+			while(--l > level) bfreeRun(fresh[l], 1);
+			return NULL;
+
+		}
+
+	}
+	for(int l=level; l<=(int) file->depth; l++){
+
+		if(l > level){
+
+			//The full block it replaces in the branch is saved first
+			if(dirty[l] && metaWrite(pathBlock[l], path[l-1].data) != 0) return NULL;
+			memset(&(path[l-1]), 0, sizeof(extent_block));
+			path[l-1].node.hdr.depth = file->depth - l;
+			pathBlock[l] = fresh[l];
+
+		}
+		dirty[l] = 1;
+		extent *ext = extentLevel(file, path, l, &count, &max);
+		ext[*count].logical = file->blocks;
+		ext[*count].start = l < (int) file->depth ? fresh[l+1] : 0;
+		ext[*count].length = 0;
+		(*count)++;
+
+	}
+	extent *ext = extentLevel(file, path, file->depth, &count, &max);
+	return &(ext[*count - 1]);
+
+}
+
+/*
+ * @brief	Adds up to count blocks at the end of a file, in the fewest runs of consecutive blocks we can find
+ * @return	Number of blocks added, -1 in case of error
+ */
+int extendFile(int fd, int count)
+{
+
+	inode *file = iget(fd);
+	//The file grows at the end of the tree, so we only need its last branch
+	extent_block path[EXTENT_MAX_DEPTH];
+	long pathBlock[EXTENT_MAX_DEPTH + 1];
+	char dirty[EXTENT_MAX_DEPTH + 1] = { 0 };
+	unsigned int *entries;
+	int max;
+	for(int l=1; l<=(int) file->depth; l++){
+
+		extent *up = extentLevel(file, path, l-1, &entries, &max);
+		pathBlock[l] = up[*entries - 1].start;
+		if(metaRead(pathBlock[l], path[l-1].data) != 0) return -1;
+
+	}
+	int added = 0;
+	while(added < count){
+
+		//Each run is a step, with the blocks of the branch it changes saved at its end
+		if(journalReserve(JOURNAL_STEP_BLOCKS) != 0) return -1;
+		//We ask for the whole run and halve it until one fits
+		int want = count - added < EXTEND_STEP_BLOCKS ? count - added : EXTEND_STEP_BLOCKS;
+		long b;
+		while((b = balloc_n(want)) == -1 && want > 1) want /= 2;
+		if(b == -1) break;
+		//A run right after the last extent makes it longer, otherwise it is a new extent
+		extent *ext = extentLevel(file, path, file->depth, &entries, &max);
+		extent *e = *entries > 0 ? &(ext[*entries - 1]) : NULL;
+		if(e == NULL || e->start + e->length != (uint64_t) b){
+
+			e = extentAppend(file, path, pathBlock, dirty);
+			if(e == NULL){
+
+				if(bfreeRun(b, want) != 0) return -1;
+				break;
+
+			}
+			e->start = b;
+
+		}
+		e->length += want;
+		dirty[file->depth] = 1;
+		file->blocks += want;
+		added += want;
+		//We save the blocks of the branch that changed
+		for(int l=1; l<=(int) file->depth; l++){
+
+			if(dirty[l] && metaWrite(pathBlock[l], path[l-1].data) != 0) return -1;
+			dirty[l] = 0;
+
+		}
+		idirty(fd);
+
+	}
+	return added;
+
+}
+
+/*
+ * @brief	Frees the blocks of n entries of an extent tree, depth levels above the extents, and the tree blocks below them
+ * @return	0 if it works, -1 in case of error
+ */
+static int extentFree(extent *ext, int n, int depth)
+{
+
+	for(int k=0; k<n; k++){
+
+		if(ext[k].start < sbk[0].dataBlock || ext[k].start - sbk[0].dataBlock + (depth > 0 ? 1 : ext[k].length) > sbk[0].num_Blocks_Data) return -1;
+		if(depth > 0){
+
+			extent_block node;
+			if(metaRead(ext[k].start, node.data) != 0) return -1;
+			if(node.node.hdr.count > (unsigned int) EXTENTS_PER_BLOCK || extentFree(node.node.ext, node.node.hdr.count, depth - 1) != 0 ||
+			   bfreeSteps(ext[k].start, 1) != 0) return -1;
+
+		}
+		else if(bfreeSteps(ext[k].start, ext[k].length) != 0) return -1;
+
+	}
+	return 0;
+
+}
+
+/*
+ * @brief	Hashes a name, of at most MAX_NAME_LENGTH characters, into a bucket of the name index
+ * @return	The bucket
+ */
+int nameHash(const char *name)
+{
+
+	//FNV-1a
+	unsigned int h = 2166136261u;
+	for(int k=0; k<MAX_NAME_LENGTH && name[k] != '\0'; k++){
+
+		h ^= (unsigned char) name[k];
+		h *= 16777619u;
+
+	}
+
+	return h & (sbk[0].nameBuckets - 1);
+
+}
+
+/*
+ * @brief	Gives the entry of a bucket of the name index, reading its block the first time
+ * @return	The entry, NULL in case of error
+ */
+static unsigned int *nameBucket(int b)
+{
+
+	int fresh;
+	char *block = tableBlock(&names, b / NAMES_PER_BLOCK, &fresh);
+	if(block == NULL) return NULL;
+	return (unsigned int *) block + b % NAMES_PER_BLOCK;
+
+}
+
+/*
+ * @brief	Adds an inode to the name index
+ * @return	0 if it works, -1 in case of error
+ */
+int nameInsert(int i)
+{
+
+	inode *file = iget(i);
+	if(file == NULL) return -1;
+	unsigned int *head = nameBucket(nameHash(file->name));
+	if(head == NULL) return -1;
+	file->nameNext = *head;
+	*head = i + 1;
+	idirty(i);
+	tableDirty(&names, nameHash(file->name) / NAMES_PER_BLOCK);
+	return 0;
+
+}
+
+/*
+ * @brief	Takes an inode out of the name index
+ * @return	0 if it works, -1 in case of error
+ */
+int nameRemove(int i)
+{
+
+	//The inode may leave memory while the chain is walked, so we keep what we need of it
+	inode *file = iget(i);
+	if(file == NULL) return -1;
+	unsigned int next = file->nameNext;
+	int bucket = nameHash(file->name);
+	unsigned int *link = nameBucket(bucket);
+	if(link == NULL) return -1;
+	int prev = -1;
+	while(*link != 0 && *link != (unsigned int) i + 1){
+
+		prev = *link - 1;
+		inode *prevInode = iget(prev);
+		if(prevInode == NULL) return -1;
+		link = &(prevInode->nameNext);
+
+	}
+	if(*link == 0) return 0;
+	*link = next;
+	//The link changed in the bucket or in the inode before
+	if(prev == -1) tableDirty(&names, bucket / NAMES_PER_BLOCK);
+	else idirty(prev);
+	return 0;
+
+}
+
+/*
+ * @brief	Searches for a inode with the fileName provided
+ * @return	i if we find the inode, -1 in case there is no file with that name
+ */
+int namei(char *fileName)
+{
+
+	//Names are stored without the terminator when they take the whole field
+	if(i_map == NULL || strlen(fileName) > MAX_NAME_LENGTH) return -1;
+	unsigned int *head = nameBucket(nameHash(fileName));
+	if(head == NULL) return -1;
+	for(unsigned int i=*head; i!=0; ){
+
+		inode *file = iget(i - 1);
+		if(file == NULL) return -1;
+		if(strncmp(file->name, fileName, MAX_NAME_LENGTH) == 0) return i - 1;
+		i = file->nameNext;
+
+	}
+
+	return -1;
+
+}
+
+/*
+ * @brief	frees an inode
+ * @return	0 if it works, -1 in case of error
+ */
+int ifree(int i){
+
+	if(i<0 || i>=sbk[0].num_inodes) return -1;
+	if(nameRemove(i) != 0) return -1;
+	inode *file = iget(i);
+	if(file == NULL) return -1;
+	memset(file, 0, sizeof(inode));
+	idirty(i);
+	bitmap_setbit(i_map, i, 0);
+	mapDirty(iMapDirty, iMapLog, i, 1);
+	return 0;
+
+
+}
+
+/*
+ * @brief	frees a block
+ * @return	0 if it works, -1 in case of error
+ */
+int bfree(int i){
+
+	//We free every extent of the file and the blocks of its extent tree and of its hash tree
+	inode *file = iget(i);
+	if(file == NULL) return -1;
+	if(hashFree(file->hashBlock, file->hashDepth) != 0) return -1;
+	return extentFree(file->ext, file->nExtents, file->depth);
+
+}
@@ -20,22 +20,72 @@
 #include "filesystem/crc.h"
 
 #define DEVICE_IMAGE "disk.dat" // Device name
-#define MAX_FILE_SIZE 10240      // Maximum file size, in bytes
+#define MAX_FILE_SIZE (1L << 40) // Maximum file size, in bytes
 #define FS_SEEK_CUR 0
 #define FS_SEEK_END 1
 #define FS_SEEK_BEGIN 2
+#define DEFAULT_CACHE_BLOCKS 64 // Default capacity of the block cache, in blocks
+#define DEFAULT_DIRTY_LIMIT 32  // Default dirty blocks kept in memory in write-back mode
+#define DEFAULT_READ_AHEAD 4    // Default blocks read ahead of sequential reads
+#define DEFAULT_INODE_CACHE 16  // Default blocks of the inode table kept in memory
+#define DEFAULT_JOURNAL_BLOCKS 256 // Default blocks of the journal, or an eighth of the device if that is less (64 at least)
+#define DEFAULT_GROUP_COMMIT 8  // Default operations committed together to the journal
+
+/*
+ * Options for mountFSOptions. Fields left to 0 take their default value.
+ */
+typedef struct {
+  int cacheBlocks; // Capacity of the block cache, in blocks
+  int writeBack;   // 1 to keep written blocks in memory until closeFile, syncFS or unmountFS
+  int dirtyLimit;  // Dirty blocks that force a write back in write-back mode
+  int readAhead;   // Blocks read ahead of sequential reads, -1 to disable it
+  int backend;     // BLOCK_BACKEND_SYNC (default), BLOCK_BACKEND_URING or BLOCK_BACKEND_MMAP
+  int inodeCacheBlocks; // Blocks of the inode table (and of the name index) kept in memory
+  int groupCommit; // Operations committed together to the journal, besides closeFile and syncFS
+  int checksumThreads; // Threads verifying the checksums of a file, the caller included, 0 for one for each CPU
+} mount_options;
+
+/*
+ * Options for mkFSOptions. Fields left to 0 take their default value.
+ */
+typedef struct {
+  long inodes;        // Inodes of the file system, 0 to derive them from bytesPerInode
+  long bytesPerInode; // Bytes of the device for each inode, 0 for the default count of inodes
+  long journalBlocks; // Blocks of the metadata journal, -1 for none
+} mkfs_options;
+
+/*
+ * Part of a file lent by readFileView: a read-only pointer into a cached block.
+ */
+typedef struct {
+  const char *data; // First byte of the segment
+  int length;       // Bytes of the segment
+} file_segment;
 
 /*
  * @brief 	Generates the proper file system structure in a storage device, as designed by the student.
  * @return 	0 if success, -1 otherwise.
  */
 int mkFS(long deviceSize);
+
+/*
+ * @brief 	Generates the file system structure in a storage device with the given options.
+ * @return 	0 if success, -1 otherwise.
+ */
+int mkFSOptions(long deviceSize, mkfs_options *options);
+
 /*
  * @brief 	Mounts a file system in the simulated device.
  * @return 	0 if success, -1 otherwise.
  */
 int mountFS(void);
 
+/*
+ * @brief 	Mounts a file system in the simulated device with the given options.
+ * @return 	0 if success, -1 otherwise.
+ */
+int mountFSOptions(mount_options *options);
+
 /*
  * @brief 	Unmounts the file system from the simulated device.
  * @return 	0 if success, -1 otherwise.
@@ -72,6 +122,19 @@ int closeFile(int fileDescriptor);
  */
 int readFile(int fileDescriptor, void *buffer, int numBytes);
 
+/*
+ * @brief	Hands out up to numBytes of a file as at most maxSegments read-only segments, without copying
+ *		them. The segments stay valid until releaseFileView, and the seek pointer moves past them. Fewer
+ *		bytes are handed out when the cache cannot lend more blocks.
+ * @return	Number of segments filled, -1 in case of error.
+ */
+int readFileView(int fileDescriptor, file_segment *segments, int maxSegments, int numBytes);
+
+/*
+ * @brief	Gives back the segments handed out by readFileView.
+ */
+void releaseFileView(file_segment *segments, int count);
+
 /*
  * @brief	Writes a number of bytes from a buffer and into a file.
  * @return	Number of bytes properly written, -1 in case of error.
@@ -99,7 +162,7 @@ int checkFile (char * fileName);
 int includeIntegrity (char * fileName);
 
 /*
- * @brief	Opens an existing file and checks its integrity
+ * @brief	Opens an existing file with integrity. Its blocks are checked against its hash tree as they are read
  * @return	The file descriptor if possible, -1 if file does not exist, -2 if the file is corrupted, -3 in case of error
  */
 int openFileIntegrity(char *fileName);
@@ -10,39 +10,165 @@
  *
  */
 
-#define bitmap_getbit(bitmap_, i_) (bitmap_[i_ >> 3] & (1 << (i_ & 0x07)))
-static inline void bitmap_setbit(char *bitmap_, int i_, int val_) {
-  if (val_)
-    bitmap_[(i_ >> 3)] |= (1 << (i_ & 0x07));
-  else
-    bitmap_[(i_ >> 3)] &= ~(1 << (i_ & 0x07));
-}
-
-#define MAX_N_INODES 48
+#include "filesystem/bitmap.h" // Allocation bitmaps
+
+#define DEFAULT_N_INODES 48 //Inodes made by mkFS when no count is given
+#define MAX_N_INODES (1 << 24)
 #define BLOCK_SIZE 2048
-#define MAX_SIZE_FILE 10 * 1024
+#define MAX_SIZE_FILE (1L << 40)
+#define MAX_SIZE_LINKS 10 * 1024 //Size of the file with the symbolic links
 #define MAX_NAME_LENGTH 32
 #define MIN_SIZE_SYS_FILES 460 * 1024
-#define MAX_SIZE_SYS_FILES 600 * 1024
 #define SYMLINK_FILE "symlinkFile.sys"
 
 typedef struct{
 
   unsigned int num_inodes;
-  unsigned int size;
-  unsigned int num_Blocks_Data;
-  unsigned int num_Blocks;
+  uint64_t size;
+  uint64_t num_Blocks_Data;
+  uint64_t num_Blocks;
+  uint64_t iMapBlock; //First block of the inode map
+  uint64_t iMapBlocks;
+  uint64_t bMapBlock; //First block of the block map
+  uint64_t bMapBlocks;
+  uint64_t inodeBlock; //First block of the inodes
+  uint64_t inodeBlocks;
+  uint64_t nameBlock; //First block of the name index
+  uint64_t nameBlocks;
+  uint64_t nameBuckets; //Buckets of the name index, a power of 2
+  uint64_t journalBlock; //First block of the journal
+  uint64_t journalBlocks; //Blocks of the journal, 0 if there is none
+  uint64_t checkpoint; //Sequence of the first transaction of the journal not written in place
+  uint64_t journalStart; //Block of the journal, from journalBlock, where that transaction starts
+  unsigned int clean; //1 if it was unmounted, 0 while it is mounted
+  uint64_t crcBlock; //First block of the checksums of the data blocks
+  uint64_t crcBlocks;
+  uint64_t dataBlock; //First block of data
 
 }sb;
 
 typedef struct{
 
-  unsigned int size;
-  unsigned int block[MAX_SIZE_FILE/BLOCK_SIZE];
-  unsigned int state;
-  unsigned int pos;
-  uint32_t crc;
+  unsigned int logical; //First block of the file covered by the extent
+  unsigned int length; //Number of blocks
+  uint64_t start; //Block of the device where it starts
+
+}extent;
+
+#define INODE_EXTENTS 4 //Entries of the root of the extent tree, kept in the inode
+#define EXTENT_MAX_DEPTH 4 //Levels of extent blocks below the inode
+
+typedef struct{
+
+  uint64_t size;
+  unsigned int blocks; //Blocks mapped by the extents
+  unsigned int depth; //Levels of extent blocks below the inode, 0 if the extents are in the inode
+  unsigned int nExtents; //Entries in use in ext
+  extent ext[INODE_EXTENTS]; //Extents, or when depth > 0 the extent blocks below (start) and their first block of the file (logical)
+  uint32_t crc; //CRC32C of the content, when it has integrity
   unsigned char hasIntegrity;
   char name[MAX_NAME_LENGTH];
+  unsigned int nameNext; //Next inode plus one in the bucket of the name index, 0 at the end
+  uint64_t hashBlock; //Top block of the hash tree over the checksums of the blocks, 0 without it
+  uint32_t hashRoot; //CRC32C of that block
+  uint32_t hashSum; //Checksums of the blocks covered by the tree, combined as the CRC32C of their content
+  unsigned int hashDepth; //Levels of inner blocks in the hash tree, 0 if the top block is a leaf
 
 }inode;
+
+#define SUPERBLOCK_BLOCK 1 //Block with the superblock, followed by the maps, the inodes, the name index, the journal, the checksums and the data
+#define INODES_PER_BLOCK (int)(BLOCK_SIZE / sizeof(inode))
+#define NAMES_PER_BLOCK (int)(BLOCK_SIZE / sizeof(unsigned int)) //Buckets of the name index in each block
+#define CRCS_PER_BLOCK (int)(BLOCK_SIZE / sizeof(uint32_t)) //CRC32C of data blocks in each block of checksums
+#define MAP_BITS_PER_BLOCK (BLOCK_SIZE * 8) //Inodes or blocks tracked by each block of a map
+#define METADATA_BATCH 64 //Metadata blocks moved by each breadv/bwritev of mountFS and mkFS
+#define IO_BATCH_BLOCKS 16 //Blocks moved by each breadv/bwritev of readFile and writeFile
+#define CHECK_BATCH_BLOCKS 256 //Blocks read by each breadv of fileCrc, verified in parallel
+#define CHECK_TASK_BLOCKS 32 //Fewest blocks verified by each worker
+#define MIN_NAME_BUCKETS 64 //Fewest buckets of the name index
+
+//Header of a block of the extent tree
+typedef struct{
+
+  unsigned int count; //Entries in use
+  unsigned int depth; //Levels below, 0 for the blocks holding extents
+
+}extent_header;
+
+#define EXTENTS_PER_BLOCK (int)((BLOCK_SIZE - sizeof(extent_header)) / sizeof(extent))
+
+//Block of the extent tree of an inode
+typedef union{
+
+  struct{
+
+    extent_header hdr;
+    extent ext[EXTENTS_PER_BLOCK];
+
+  }node;
+  char data[BLOCK_SIZE];
+
+}extent_block;
+
+#define JOURNAL_MAGIC 0x4c4e524a //Marks the descriptors of the journal
+#define JOURNAL_MIN_BLOCKS 64 //Smallest journal, below it the file system has none
+
+//Block logged by a transaction
+typedef struct{
+
+  uint64_t block; //Block of the device
+  uint32_t crc; //CRC32 of the copy in the journal
+  uint32_t reserved;
+
+}journal_entry;
+
+//Header of a transaction, followed in the journal by the copy of each block logged
+typedef struct{
+
+  uint32_t magic;
+  uint32_t count; //Blocks logged
+  uint64_t sequence; //Sequence of the transaction, one more than the one before
+  uint32_t crc; //CRC32 of the descriptor, with this field at 0
+  uint32_t revokes; //Blocks revoked, in the entries after the ones of the blocks logged, without a copy
+
+}journal_header;
+
+#define JOURNAL_TXN_BLOCKS (int)((BLOCK_SIZE - sizeof(journal_header)) / sizeof(journal_entry))
+#define JOURNAL_STEP_BLOCKS 48 //Most metadata blocks changed by a step of an operation, logged together
+#define EXTEND_STEP_BLOCKS (16 * MAP_BITS_PER_BLOCK) //Most blocks added to a file in one step
+
+//Descriptor block of a transaction
+typedef union{
+
+  struct{
+
+    journal_header hdr;
+    journal_entry entry[JOURNAL_TXN_BLOCKS];
+
+  }txn;
+  char data[BLOCK_SIZE];
+
+}journal_block;
+
+#define HASH_LEAF_ENTRIES (int)(BLOCK_SIZE / sizeof(uint32_t)) //Checksums of blocks of the file in each leaf of a hash tree
+
+//Entry of an inner block of a hash tree
+typedef struct{
+
+  uint64_t block; //Block below, 0 if it was not needed yet
+  uint32_t crc; //CRC32C of that block
+  uint32_t sum; //Checksums of the blocks of the file it covers, combined as the CRC32C of their content
+
+}hash_entry;
+
+#define HASH_NODE_ENTRIES (int)(BLOCK_SIZE / sizeof(hash_entry))
+
+//Block of the hash tree of an inode: the leaves hold the CRC32C of the blocks of the file in order,
+//the inner blocks the CRC32C of the blocks below, up to the top block whose CRC32C is in the inode
+typedef union{
+
+  uint32_t leaf[HASH_LEAF_ENTRIES];
+  hash_entry node[HASH_NODE_ENTRIES];
+  char data[BLOCK_SIZE];
+
+}hash_block;
@@ -0,0 +1,97 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	workers.c
+ * @brief 	Pool of threads that take the tasks of a job from a shared counter.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#include "filesystem/workers.h"
+#include <pthread.h>
+
+static struct {
+	pthread_t threads[MAX_WORKERS];
+	int count;                        // Threads started, without the caller
+	pthread_mutex_t lock;
+	pthread_cond_t wake;              // A job was posted or the pool is stopping
+	pthread_cond_t done;              // The last task of the job finished
+	void (*task)(void *arg, int i);
+	void *arg;
+	int tasks;                        // Tasks of the current job
+	int next;                         // Next task to hand out
+	int pending;                      // Tasks not finished yet
+	int stopping;
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+/*
+ * Takes tasks of the current job until there are none left. Called with
+ * the lock held, that is released while each task runs.
+ */
+static void run_tasks(void) {
+	while(pool.next < pool.tasks) {
+		int i = pool.next++;
+		pthread_mutex_unlock(&pool.lock);
+		pool.task(pool.arg, i);
+		pthread_mutex_lock(&pool.lock);
+		if(--pool.pending == 0) pthread_cond_signal(&pool.done);
+	}
+}
+
+static void *worker(void *unused) {
+	(void) unused;
+	pthread_mutex_lock(&pool.lock);
+	while(!pool.stopping) {
+		run_tasks();
+		if(!pool.stopping) pthread_cond_wait(&pool.wake, &pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+int workers_start(int threads) {
+	workers_stop();
+	if(threads > MAX_WORKERS) threads = MAX_WORKERS;
+	pool.stopping = 0;
+	for(int i = 0; i < threads - 1; i++) {
+		if(pthread_create(&pool.threads[i], NULL, worker, NULL) != 0) {
+			workers_stop();
+			return -1;
+		}
+		pool.count++;
+	}
+	return 0;
+}
+
+void workers_stop(void) {
+	pthread_mutex_lock(&pool.lock);
+	pool.stopping = 1;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+	for(int i = 0; i < pool.count; i++) pthread_join(pool.threads[i], NULL);
+	pool.count = 0;
+}
+
+int workers_count(void) {
+	return pool.count + 1;
+}
+
+void workers_run(void (*task)(void *arg, int i), void *arg, int count) {
+	if(pool.count == 0 || count <= 1) {
+		for(int i = 0; i < count; i++) task(arg, i);
+		return;
+	}
+	pthread_mutex_lock(&pool.lock);
+	pool.task = task;
+	pool.arg = arg;
+	pool.tasks = count;
+	pool.next = 0;
+	pool.pending = count;
+	pthread_cond_broadcast(&pool.wake);
+	run_tasks();
+	while(pool.pending > 0) pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
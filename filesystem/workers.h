@@ -0,0 +1,42 @@
+/*
+ *
+ * Operating System Design / Diseño de Sistemas Operativos
+ * (c) ARCOS.INF.UC3M.ES
+ *
+ * @file 	workers.h
+ * @brief 	Headers of the pool of threads that share CPU-bound work, such as checksums.
+ * @date	Last revision 01/04/2020
+ *
+ */
+
+
+#ifndef _WORKERS_H_
+#define _WORKERS_H_
+
+#define MAX_WORKERS 64 // Most threads of the pool, the caller included
+
+/*
+ * Starts a pool of threads - 1 threads, that join the caller of workers_run.
+ * With threads <= 1 there is no pool and workers_run does every task itself.
+ * Returns 0 if correct or -1 in case of error, leaving no pool.
+ */
+int workers_start(int threads);
+
+/*
+ * Stops the threads of the pool and waits for them.
+ */
+void workers_stop(void);
+
+/*
+ * Returns the threads that run the tasks of workers_run, the caller included.
+ */
+int workers_count(void);
+
+/*
+ * Runs task(arg, i) for every i in [0, count), spreading the tasks among
+ * the threads of the pool and the caller, and returns once all of them
+ * finished. Only one thread may call it at a time.
+ */
+void workers_run(void (*task)(void *arg, int i), void *arg, int count);
+
+#endif
@@ -13,7 +13,12 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "filesystem/filesystem.h"
+#include "filesystem/bitmap.h"
+#include "filesystem/metadata.h"
+#include "zlib/zlib.h"
 #include "stdlib.h"
 
 
@@ -26,6 +31,71 @@
 #define N_BLOCKS 25					  // Number of blocks in the device
 #define DEV_SIZE N_BLOCKS *BLOCK_SIZE // Device size, in bytes
 
+// Bit by bit CRC16 (CCITT, init value 0) and CRC64 (Jones, reflected, init value 0), to cross-check the sliced ones
+static uint16_t crc16Reference(const unsigned char *buffer, unsigned int length)
+{
+	uint16_t crc = 0;
+	for (unsigned int i = 0; i < length; i++) {
+		crc ^= (uint16_t) (buffer[i] << 8);
+		for (int k = 0; k < 8; k++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+// Bit by bit CRC32C (Castagnoli, reflected), to cross-check the kernels of the CPU
+static uint32_t crc32cReference(const unsigned char *buffer, unsigned int length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (unsigned int i = 0; i < length; i++) {
+		crc ^= buffer[i];
+		for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+static uint64_t crc64Reference(const unsigned char *buffer, unsigned int length)
+{
+	uint64_t crc = 0;
+	for (unsigned int i = 0; i < length; i++) {
+		crc ^= buffer[i];
+		for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ 0x95ac9329ac4bc9b5ULL : crc >> 1;
+	}
+	return crc;
+}
+
+// Reads or writes a block of the device image straight, around the block layer and its cache
+static int deviceBlock(long block, char *buffer, int store)
+{
+	int fd = open(DEVICE_IMAGE, O_RDWR);
+	if (fd < 0) return -1;
+	ssize_t done = store ? pwrite(fd, buffer, BLOCK_SIZE, (off_t) block * BLOCK_SIZE) : pread(fd, buffer, BLOCK_SIZE, (off_t) block * BLOCK_SIZE);
+	close(fd);
+	return done == BLOCK_SIZE ? 0 : -1;
+}
+
+// First block of the device image from the given one with the given content, -1 if there is none
+static long deviceFind(const char *block, long first)
+{
+	char found[BLOCK_SIZE];
+	for (long b = first; deviceBlock(b, found, 0) == 0; ++b) {
+		if (memcmp(found, block, BLOCK_SIZE) == 0) return b;
+	}
+	return -1;
+}
+
+// Bytes a new file takes until the device is full, removed afterwards
+static long deviceFree(void)
+{
+	char fill[BLOCK_SIZE] = { 0 };
+	long total = 0;
+	int written;
+	if (createFile("/free") != 0) return -1;
+	int fd = openFile("/free");
+	while (fd >= 0 && (written = writeFile(fd, fill, BLOCK_SIZE)) > 0) total += written;
+	if (fd < 0 || closeFile(fd) != 0 || removeFile("/free") != 0) return -1;
+	return total;
+}
+
 int main()
 {
 	//int ret;
@@ -1179,6 +1249,751 @@ int main()
 	closeFileIntegrity(of_result);
 
 
+	unmountFS();
+
+
+	// (D) Every inode can be open at once, with their blocks of the table spread over a cache of two blocks
+	const int OPEN_FILES = 100;
+	mkfs_options openMkfs = { 0 };
+	openMkfs.inodes = OPEN_FILES;
+	mount_options openMount = { 0 };
+	openMount.inodeCacheBlocks = 2;
+	int openErrors = mkFSOptions(460 * 1024, &openMkfs) != 0 || mountFSOptions(&openMount) != 0;
+	int openFds[OPEN_FILES];
+	char openName[32], openData[64];
+	for (int i = 0; i < OPEN_FILES && openErrors == 0; ++i) {
+		sprintf(openName, "/open%d", i);
+		openFds[i] = createFile(openName) == 0 ? openFile(openName) : -1;
+		if ( openFds[i] < 0 ) openErrors++;
+	}
+	if ( openErrors == 0 && createFile("/openExtra") != -2 ) openErrors++;
+	for (int i = 0; i < OPEN_FILES && openErrors == 0; ++i) {
+		sprintf(openData, "contents of the file %d", i);
+		if ( writeFile(openFds[i], openData, sizeof(openData)) != sizeof(openData) ) openErrors++;
+	}
+	for (int i = 0; i < OPEN_FILES && openErrors == 0; ++i) {
+		char openRead[64];
+		sprintf(openData, "contents of the file %d", i);
+		if ( lseekFile(openFds[i], 0, FS_SEEK_BEGIN) != 0 || readFile(openFds[i], openRead, sizeof(openRead)) != sizeof(openRead) ||
+		     strcmp(openRead, openData) != 0 || closeFile(openFds[i]) != 0 ) openErrors++;
+	}
+	if ( unmountFS() != 0 ) openErrors++;
+	if ( openErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST open every file ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST open every file ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+
+	// (D) After a crash, the replay of the journal leaves alone a block of a hash tree that was freed and then taken for data
+	mkfs_options crashMkfs = { 0 };
+	crashMkfs.inodes = 8;
+	crashMkfs.journalBlocks = 128;
+	int crashErrors = mkFSOptions(460 * 1024, &crashMkfs) != 0;
+	char crashData[2 * 2048], crashRead[2 * 2048];
+	memset(crashData, 'R', sizeof(crashData));
+	pid_t crashChild = crashErrors == 0 ? fork() : -1;
+	if ( crashChild == 0 ) {
+		// The file with integrity has a block of hash tree logged by the journal, and the disk is filled after it
+		if ( mountFS() != 0 || createFile("/crashTree") != 0 || includeIntegrity("/crashTree") != 0 || createFile("/crashFill") != 0 ) _exit(1);
+		int fillFd = openFile("/crashFill");
+		char *fill = calloc(1, 460 * 1024);
+		if ( fillFd < 0 || fill == NULL || writeFile(fillFd, fill, 460 * 1024) <= 0 || closeFile(fillFd) != 0 ) _exit(1);
+		// Its blocks are freed, the next file takes them, and the file system is never unmounted
+		if ( removeFile("/crashTree") != 0 || createFile("/crashData") != 0 ) _exit(1);
+		int dataFd = openFile("/crashData");
+		if ( dataFd < 0 || writeFile(dataFd, crashData, sizeof(crashData)) != sizeof(crashData) || closeFile(dataFd) != 0 ) _exit(1);
+		_exit(0);
+	}
+	int crashStatus = 0;
+	if ( crashChild < 0 || waitpid(crashChild, &crashStatus, 0) != crashChild || !WIFEXITED(crashStatus) || WEXITSTATUS(crashStatus) != 0 ) crashErrors++;
+	if ( crashErrors == 0 && mountFS() == 0 ) {
+		int dataFd = openFile("/crashData");
+		if ( dataFd < 0 || readFile(dataFd, crashRead, sizeof(crashRead)) != sizeof(crashRead) || memcmp(crashRead, crashData, sizeof(crashData)) != 0 ) crashErrors++;
+		if ( closeFile(dataFd) != 0 || openFile("/crashTree") != -1 || unmountFS() != 0 ) crashErrors++;
+	}
+	else crashErrors++;
+	if ( crashErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST journal replay revokes ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST journal replay revokes ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+
+	// (D) The sliced CRC16 and CRC64 match their bit by bit definitions, at every length and alignment
+	unsigned char crcData[300];
+	for (int i = 0; i < 300; ++i) crcData[i] = (unsigned char) (i * 151 + 7);
+	int crcErrors = 0;
+	if ( CRC16((unsigned char *) "123456789", 9) != 0x31c3 || CRC64((unsigned char *) "123456789", 9) != 0xe9c6d914c4b8d9caULL ) crcErrors++;
+	for (int offset = 0; offset < 8; ++offset) {
+		for (unsigned int length = 0; length + offset <= 300; ++length) {
+			if ( CRC16(crcData + offset, length) != crc16Reference(crcData + offset, length) ) crcErrors++;
+			if ( CRC64(crcData + offset, length) != crc64Reference(crcData + offset, length) ) crcErrors++;
+		}
+	}
+	if ( crcErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC16/CRC64 ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC16/CRC64 ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The streaming CRCs, given the data in uneven pieces, match the CRCs of the whole data
+	crc16_ctx ctx16; crc32_ctx ctx32; crc32c_ctx ctx32c; crc64_ctx ctx64;
+	CRC16_init(&ctx16); CRC32_init(&ctx32); CRC32C_init(&ctx32c); CRC64_init(&ctx64);
+	for (unsigned int done = 0, piece = 0; done < 300; done += piece) {
+		piece = (done * 7) % 97 + 1;
+		if (piece > 300 - done) piece = 300 - done;
+		CRC16_update(&ctx16, crcData + done, piece);
+		CRC32_update(&ctx32, crcData + done, piece);
+		CRC32C_update(&ctx32c, crcData + done, piece);
+		CRC64_update(&ctx64, crcData + done, piece);
+	}
+	if ( CRC16_final(&ctx16) != CRC16(crcData, 300) || CRC32_final(&ctx32) != CRC32(crcData, 300) ||
+	     CRC32C_final(&ctx32c) != CRC32C(crcData, 300) || CRC64_final(&ctx64) != CRC64(crcData, 300) ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST streaming CRC ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST streaming CRC ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Combining the CRC32C of two buffers gives the CRC32C of both together, also past 2^29 bytes
+	const unsigned int PATTERN_SIZE = 1 << 20;
+	unsigned char *pattern = malloc(PATTERN_SIZE);
+	int combineErrors = pattern == NULL;
+	for (unsigned int i = 0; pattern != NULL && i < PATTERN_SIZE; ++i) pattern[i] = (unsigned char) (i * 31 + (i >> 11));
+	const uint64_t combineLengths[] = { 0, 1, 2048, 300000, 1UL << 29, (1UL << 29) + (1UL << 20) + 5 };
+	for (unsigned int c = 0; pattern != NULL && c < sizeof(combineLengths) / sizeof(combineLengths[0]); ++c) {
+		// The second buffer is the pattern over and over, the first one the data of the tests before
+		crc32c_ctx whole, second;
+		CRC32C_init(&whole); CRC32C_init(&second);
+		CRC32C_update(&whole, crcData, 300);
+		for (uint64_t done = 0, piece = 0; done < combineLengths[c]; done += piece) {
+			piece = combineLengths[c] - done < PATTERN_SIZE ? combineLengths[c] - done : PATTERN_SIZE;
+			CRC32C_update(&whole, pattern, piece);
+			CRC32C_update(&second, pattern, piece);
+		}
+		if ( CRC32C_combine(CRC32C(crcData, 300), CRC32C_final(&second), combineLengths[c]) != CRC32C_final(&whole) ) combineErrors++;
+	}
+	free(pattern);
+	if ( combineErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC32C_combine ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC32C_combine ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The allocator places runs from the hint, skips the free runs that are too short and wraps around
+	uint64_t allocMap[BITMAP_WORDS(200)] = { 0 };
+	long hint = 0;
+	int allocErrors = 0;
+	if ( bitmap_alloc_run(allocMap, 200, 5, &hint) != 0 || hint != 5 ) allocErrors++;
+	bitmap_setrun(allocMap, 5, 5, 1);
+	if ( bitmap_alloc_run(allocMap, 200, 3, &hint) != 10 || hint != 13 ) allocErrors++;
+	bitmap_setrun(allocMap, 0, 200, 1);
+	bitmap_setrun(allocMap, 20, 2, 0);
+	bitmap_setrun(allocMap, 100, 4, 0);
+	hint = 0;
+	if ( bitmap_alloc_run(allocMap, 200, 4, &hint) != 100 || hint != 104 ) allocErrors++;
+	bitmap_setrun(allocMap, 30, 6, 0);
+	hint = 150;
+	if ( bitmap_alloc_run(allocMap, 200, 6, &hint) != 30 || hint != 36 ) allocErrors++;
+	bitmap_setrun(allocMap, 195, 5, 0);
+	if ( bitmap_alloc_run(allocMap, 200, 6, &hint) != -1 ) allocErrors++;
+	if ( bitmap_alloc_run(allocMap, 200, 5, &hint) != 195 || hint != 200 ) allocErrors++;
+	if ( bitmap_alloc(allocMap, 200, &hint) != 20 || bitmap_alloc(allocMap, 200, &hint) != 21 || bitmap_alloc(allocMap, 200, &hint) != -1 ) allocErrors++;
+	// A single bit taken from a large free map costs the same as from a small one
+	long allocBits = 1L << 26;
+	uint64_t *largeMap = calloc(BITMAP_WORDS(allocBits), sizeof(uint64_t));
+	hint = 0;
+	for (long i = 0; i < 100000 && largeMap != NULL; ++i) {
+		if ( bitmap_alloc(largeMap, allocBits, &hint) != i ) allocErrors++;
+	}
+	free(largeMap);
+	if ( allocErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST bitmap allocator ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST bitmap allocator ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The device stays open from bopen to the last bclose, so its blocks are reached while its name is gone
+	char devBlock[BLOCK_SIZE], devRead[BLOCK_SIZE];
+	int devErrors = 0, devMoved = 0;
+	if ( bopen(DEVICE_IMAGE) != 0 || bopen(DEVICE_IMAGE) != 0 ) devErrors++;
+	else devMoved = rename(DEVICE_IMAGE, DEVICE_IMAGE ".moved") == 0;
+	for (long b = 0; b < 8 && devMoved; ++b) {
+		memset(devBlock, 'a' + b, BLOCK_SIZE);
+		if ( bwrite(DEVICE_IMAGE, b, devBlock) != 0 || bread(DEVICE_IMAGE, b, devRead) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 ) devErrors++;
+	}
+	// The sessions are counted, and without one every call opens the device by its name
+	if ( bclose() != 0 || bread(DEVICE_IMAGE, 7, devRead) != 0 || bclose() != 0 || bread(DEVICE_IMAGE, 7, devRead) != -1 ) devErrors++;
+	if ( !devMoved || rename(DEVICE_IMAGE ".moved", DEVICE_IMAGE) != 0 ) devErrors++;
+	if ( devErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST persistent device ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST persistent device ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Reads of cached blocks are hits, a full cache drops its least recently used block, and writes go through it
+	unsigned long hits, misses;
+	int cacheErrors = bopen(DEVICE_IMAGE) != 0 || bcache_init(4, 0) != 0;
+	const long cacheReads[] = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 4, 0, 1 };
+	for (unsigned int i = 0; cacheErrors == 0 && i < sizeof(cacheReads) / sizeof(cacheReads[0]); ++i) {
+		if ( bread(DEVICE_IMAGE, cacheReads[i], devRead) != 0 ) cacheErrors++;
+	}
+	bcache_stats(&hits, &misses);
+	if ( hits != 6 || misses != 6 ) cacheErrors++;
+	memset(devBlock, 'w', BLOCK_SIZE);
+	if ( bwrite(DEVICE_IMAGE, 4, devBlock) != 0 || deviceBlock(4, devRead, 0) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 ) cacheErrors++;
+	if ( bread(DEVICE_IMAGE, 4, devRead) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 ) cacheErrors++;
+	bcache_stats(&hits, &misses);
+	if ( hits != 7 || misses != 6 ) cacheErrors++;
+	if ( bclose() != 0 ) cacheErrors++;
+	if ( cacheErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block cache ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block cache ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) In write-back mode the written blocks reach the device at bflush, at the dirty limit or at closeFile
+	memset(devBlock, 'o', BLOCK_SIZE);
+	int backErrors = deviceBlock(10, devBlock, 1) != 0 || bopen(DEVICE_IMAGE) != 0 || bcache_init(8, 4) != 0;
+	memset(devBlock, 'b', BLOCK_SIZE);
+	for (long b = 10; b < 13 && backErrors == 0; ++b) {
+		if ( bwrite(DEVICE_IMAGE, b, devBlock) != 0 ) backErrors++;
+	}
+	if ( deviceBlock(10, devRead, 0) != 0 || devRead[0] != 'o' ) backErrors++;
+	if ( bread(DEVICE_IMAGE, 10, devRead) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 ) backErrors++;
+	if ( bflush() != 0 || deviceBlock(10, devRead, 0) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 ) backErrors++;
+	// The fourth dirty block writes back the ones before it
+	memset(devBlock, 'c', BLOCK_SIZE);
+	for (long b = 20; b < 24 && backErrors == 0; ++b) {
+		if ( bwrite(DEVICE_IMAGE, b, devBlock) != 0 ) backErrors++;
+	}
+	if ( deviceBlock(20, devRead, 0) != 0 || memcmp(devBlock, devRead, BLOCK_SIZE) != 0 || bclose() != 0 ) backErrors++;
+	mount_options backMount = { 0 };
+	backMount.writeBack = 1;
+	backMount.groupCommit = 64;
+	memset(devBlock, 'B', BLOCK_SIZE);
+	if ( backErrors == 0 && (mkFS(460 * 1024) != 0 || mountFSOptions(&backMount) != 0 || createFile("/back") != 0) ) backErrors++;
+	int backFd = backErrors == 0 ? openFile("/back") : -1;
+	if ( backFd < 0 || writeFile(backFd, devBlock, BLOCK_SIZE) != BLOCK_SIZE || deviceFind(devBlock, 0) != -1 ) backErrors++;
+	if ( closeFile(backFd) != 0 || deviceFind(devBlock, 0) < 0 || unmountFS() != 0 ) backErrors++;
+	if ( backErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST write-back ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST write-back ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Sequential reads find the next blocks of the file already read ahead into the cache
+	const int AHEAD_BLOCKS = 32;
+	char *aheadData = malloc(AHEAD_BLOCKS * BLOCK_SIZE);
+	unsigned long aheadMisses[2] = { 0, 0 };
+	int aheadErrors = aheadData == NULL || mkFS(460 * 1024) != 0 || mountFS() != 0 || createFile("/ahead") != 0;
+	for (int i = 0; aheadData != NULL && i < AHEAD_BLOCKS * BLOCK_SIZE; ++i) aheadData[i] = (char) (i * 13 + i / BLOCK_SIZE);
+	int aheadFd = aheadErrors == 0 ? openFile("/ahead") : -1;
+	if ( aheadFd < 0 || writeFile(aheadFd, aheadData, AHEAD_BLOCKS * BLOCK_SIZE) != AHEAD_BLOCKS * BLOCK_SIZE || closeFile(aheadFd) != 0 || unmountFS() != 0 ) aheadErrors++;
+	// Read once without read-ahead and once with it, block by block, from a cache left empty by the mount
+	for (int m = 0; m < 2 && aheadErrors == 0; ++m) {
+		mount_options aheadMount = { 0 };
+		aheadMount.readAhead = m == 0 ? -1 : 8;
+		if ( mountFSOptions(&aheadMount) != 0 || (aheadFd = openFile("/ahead")) < 0 ) { aheadErrors++; break; }
+		for (int k = 0; k < AHEAD_BLOCKS; ++k) {
+			if ( readFile(aheadFd, devRead, BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, aheadData + k * BLOCK_SIZE, BLOCK_SIZE) != 0 ) aheadErrors++;
+		}
+		bcache_stats(&hits, &aheadMisses[m]);
+		if ( closeFile(aheadFd) != 0 || unmountFS() != 0 ) aheadErrors++;
+	}
+	free(aheadData);
+	if ( aheadErrors != 0 || aheadMisses[1] + AHEAD_BLOCKS / 2 > aheadMisses[0] ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST read-ahead ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST read-ahead ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Vectored transfers move every block of the list, in runs or alone and in any order
+	const long vecBlocks[] = { 42, 30, 31, 7, 32, 29 };
+	const int VEC_COUNT = sizeof(vecBlocks) / sizeof(vecBlocks[0]);
+	char vecData[VEC_COUNT][BLOCK_SIZE], vecRead[VEC_COUNT][BLOCK_SIZE];
+	block_io vecIo[VEC_COUNT];
+	int vecErrors = bopen(DEVICE_IMAGE) != 0;
+	for (int i = 0; i < VEC_COUNT; ++i) {
+		memset(vecData[i], 'A' + i, BLOCK_SIZE);
+		vecIo[i].blockNumber = vecBlocks[i];
+		vecIo[i].buffer = vecData[i];
+	}
+	if ( vecErrors == 0 && bwritev(DEVICE_IMAGE, vecIo, VEC_COUNT) != 0 ) vecErrors++;
+	for (int i = 0; i < VEC_COUNT; ++i) {
+		vecIo[i].blockNumber = vecBlocks[VEC_COUNT - 1 - i];
+		vecIo[i].buffer = vecRead[i];
+	}
+	if ( vecErrors == 0 && breadv(DEVICE_IMAGE, vecIo, VEC_COUNT) != 0 ) vecErrors++;
+	for (int i = 0; i < VEC_COUNT && vecErrors == 0; ++i) {
+		if ( memcmp(vecRead[i], vecData[VEC_COUNT - 1 - i], BLOCK_SIZE) != 0 ) vecErrors++;
+		if ( deviceBlock(vecBlocks[i], devRead, 0) != 0 || memcmp(devRead, vecData[i], BLOCK_SIZE) != 0 ) vecErrors++;
+	}
+	// A block past the end of the device fails the whole list
+	vecIo[2].blockNumber = 1L << 40;
+	if ( breadv(DEVICE_IMAGE, vecIo, VEC_COUNT) != -1 || breadv(DEVICE_IMAGE, vecIo, 0) != 0 || bclose() != 0 ) vecErrors++;
+	if ( vecErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST breadv/bwritev ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST breadv/bwritev ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) With io_uring the blocks submitted together are done once bcomplete waited, and a file system works on it
+	int uringErrors = bopen(DEVICE_IMAGE) != 0;
+	int uring = uringErrors == 0 && bbackend(BLOCK_BACKEND_URING) == 0;
+	for (int i = 0; i < VEC_COUNT; ++i) {
+		vecIo[i].blockNumber = vecBlocks[i];
+		vecIo[i].buffer = vecData[VEC_COUNT - 1 - i];
+	}
+	if ( uring && (bsubmit(DEVICE_IMAGE, vecIo, VEC_COUNT, 1) != 0 || bcomplete(1) != 0) ) uringErrors++;
+	for (int i = 0; i < VEC_COUNT; ++i) vecIo[i].buffer = vecRead[i];
+	if ( uring && (bsubmit(DEVICE_IMAGE, vecIo, VEC_COUNT, 0) != 0 || bcomplete(1) != 0) ) uringErrors++;
+	for (int i = 0; uring && i < VEC_COUNT; ++i) {
+		if ( memcmp(vecRead[i], vecData[VEC_COUNT - 1 - i], BLOCK_SIZE) != 0 ) uringErrors++;
+	}
+	if ( bclose() != 0 || (uring && (deviceBlock(vecBlocks[0], devRead, 0) != 0 || memcmp(devRead, vecData[VEC_COUNT - 1], BLOCK_SIZE) != 0)) ) uringErrors++;
+	// What the file system wrote through the ring is read back through pread
+	mount_options uringMount = { 0 };
+	uringMount.backend = BLOCK_BACKEND_URING;
+	if ( uring && (mkFS(460 * 1024) != 0 || mountFSOptions(&uringMount) != 0 || createFile("/uring") != 0) ) uringErrors++;
+	int uringFd = uring && uringErrors == 0 ? openFile("/uring") : -1;
+	if ( uring && (uringFd < 0 || writeFile(uringFd, vecData, sizeof(vecData)) != sizeof(vecData) || closeFile(uringFd) != 0 || unmountFS() != 0) ) uringErrors++;
+	if ( uring && uringErrors == 0 && (mountFS() != 0 || (uringFd = openFile("/uring")) < 0 || readFile(uringFd, vecRead, sizeof(vecRead)) != sizeof(vecRead) ||
+	     memcmp(vecRead, vecData, sizeof(vecData)) != 0 || closeFile(uringFd) != 0 || unmountFS() != 0) ) uringErrors++;
+	if ( uringErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST io_uring backend ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, uring ? "TEST io_uring backend " : "TEST io_uring backend (not supported by the kernel) ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The mapping of the device replaces the cache, and a file written through it is read back through pread
+	memset(devBlock, 'm', BLOCK_SIZE);
+	int mapErrors = bopen(DEVICE_IMAGE) != 0 || bbackend(BLOCK_BACKEND_MMAP) != 0 || bcache_init(8, 0) != 0;
+	if ( mapErrors == 0 && (bwrite(DEVICE_IMAGE, 12, devBlock) != 0 || bflush() != 0 || bread(DEVICE_IMAGE, 12, devRead) != 0 || memcmp(devRead, devBlock, BLOCK_SIZE) != 0) ) mapErrors++;
+	if ( mapErrors == 0 && (deviceBlock(12, devRead, 0) != 0 || memcmp(devRead, devBlock, BLOCK_SIZE) != 0) ) mapErrors++;
+	if ( bclose() != 0 ) mapErrors++;
+	// A cache in place keeps the mapping out
+	if ( bopen(DEVICE_IMAGE) != 0 || bcache_init(8, 0) != 0 || bbackend(BLOCK_BACKEND_MMAP) != -1 || bclose() != 0 ) mapErrors++;
+	mount_options mapMount = { 0 };
+	mapMount.backend = BLOCK_BACKEND_MMAP;
+	if ( mapErrors == 0 && (mkFS(460 * 1024) != 0 || mountFSOptions(&mapMount) != 0 || createFile("/map") != 0) ) mapErrors++;
+	int mapFd = mapErrors == 0 ? openFile("/map") : -1;
+	if ( mapFd < 0 || writeFile(mapFd, vecData, sizeof(vecData)) != sizeof(vecData) || closeFile(mapFd) != 0 || unmountFS() != 0 ) mapErrors++;
+	if ( mapErrors == 0 && (mountFS() != 0 || (mapFd = openFile("/map")) < 0 || readFile(mapFd, vecRead, sizeof(vecRead)) != sizeof(vecRead) ||
+	     memcmp(vecRead, vecData, sizeof(vecData)) != 0 || closeFile(mapFd) != 0 || unmountFS() != 0) ) mapErrors++;
+	if ( mapErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mmap backend ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST mmap backend ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) A view hands out the bytes of the file as pointers into the cached blocks, one segment for each block
+	const char *viewData = (const char *) vecData;
+	file_segment viewSegments[8];
+	int viewErrors = mkFS(460 * 1024) != 0 || mountFS() != 0 || createFile("/view") != 0;
+	int viewFd = viewErrors == 0 ? openFile("/view") : -1;
+	if ( viewFd < 0 || writeFile(viewFd, vecData, sizeof(vecData)) != sizeof(vecData) || lseekFile(viewFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(viewFd, 100, FS_SEEK_CUR) != 0 ) viewErrors++;
+	int viewCount = viewErrors == 0 ? readFileView(viewFd, viewSegments, 8, 5000) : -1;
+	if ( viewCount != 3 ) viewErrors++;
+	for (int i = 0, done = 100; i < viewCount && viewErrors == 0; done += viewSegments[i++].length) {
+		if ( memcmp(viewSegments[i].data, viewData + done, viewSegments[i].length) != 0 ) viewErrors++;
+	}
+	if ( viewErrors == 0 && viewSegments[0].length + viewSegments[1].length + viewSegments[2].length != 5000 ) viewErrors++;
+	// The seek pointer is past the view, and a single segment stops at the end of its block
+	if ( viewErrors == 0 && (readFile(viewFd, devRead, 10) != 10 || memcmp(devRead, viewData + 5100, 10) != 0) ) viewErrors++;
+	releaseFileView(viewSegments, viewCount > 0 ? viewCount : 0);
+	if ( viewErrors == 0 && (readFileView(viewFd, viewSegments, 1, 5000) != 1 || viewSegments[0].length != 3 * BLOCK_SIZE - 5110) ) viewErrors++;
+	releaseFileView(viewSegments, 1);
+	if ( lseekFile(viewFd, 0, FS_SEEK_END) != 0 || readFileView(viewFd, viewSegments, 8, 5000) != 0 ) viewErrors++;
+	// A borrowed block is the block the device has
+	const char *borrowed = bborrow(DEVICE_IMAGE, 1);
+	if ( borrowed == NULL || bread(DEVICE_IMAGE, 1, devRead) != 0 || memcmp(borrowed, devRead, BLOCK_SIZE) != 0 ) viewErrors++;
+	if ( borrowed != NULL ) brelease(borrowed);
+	if ( closeFile(viewFd) != 0 || unmountFS() != 0 ) viewErrors++;
+	if ( viewErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readFileView ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST readFileView ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The name index finds every file by its name, also after removals, new names and a new mount
+	const int NAME_FILES = 120;
+	mkfs_options nameMkfs = { 0 };
+	nameMkfs.inodes = NAME_FILES;
+	int nameErrors = mkFSOptions(460 * 1024, &nameMkfs) != 0 || mountFS() != 0;
+	for (int i = 0; i < NAME_FILES && nameErrors == 0; ++i) {
+		sprintf(openName, "/name%d", i);
+		if ( createFile(openName) != 0 ) nameErrors++;
+	}
+	if ( nameErrors == 0 && (createFile("/name7") != -1 || openFile("/name") != -1 || openFile("/name1500") != -1) ) nameErrors++;
+	for (int i = 0; i < NAME_FILES && nameErrors == 0; i += 2) {
+		sprintf(openName, "/name%d", i);
+		if ( removeFile(openName) != 0 ) nameErrors++;
+		sprintf(openName, "/renamed%d", i);
+		if ( createFile(openName) != 0 ) nameErrors++;
+	}
+	for (int m = 0; m < 2 && nameErrors == 0; ++m) {
+		// Every name is looked up before and after the file system is mounted again
+		if ( m == 1 && (unmountFS() != 0 || mountFS() != 0) ) nameErrors++;
+		for (int i = 0; i < NAME_FILES && nameErrors == 0; ++i) {
+			sprintf(openName, i % 2 == 0 ? "/renamed%d" : "/name%d", i);
+			int nameFd = openFile(openName);
+			if ( nameFd < 0 || closeFile(nameFd) != 0 ) nameErrors++;
+			sprintf(openName, i % 2 == 0 ? "/name%d" : "/renamed%d", i);
+			if ( openFile(openName) != -1 ) nameErrors++;
+		}
+	}
+	if ( unmountFS() != 0 ) nameErrors++;
+	if ( nameErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST name index ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST name index ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) A file of many blocks, written in pieces that cross them, is read anywhere and gives its blocks back when removed
+	const int EXTENT_SIZE = 40 * BLOCK_SIZE + 77;
+	char *extentData = malloc(EXTENT_SIZE), *extentRead = malloc(EXTENT_SIZE);
+	int extentErrors = extentData == NULL || extentRead == NULL || mkFS(460 * 1024) != 0 || mountFS() != 0;
+	long extentFree = extentErrors == 0 ? deviceFree() : -1;
+	for (int i = 0; extentData != NULL && i < EXTENT_SIZE; ++i) extentData[i] = (char) (i * 7 + i / 3001);
+	int extentFd = extentFree > 0 && createFile("/extent") == 0 ? openFile("/extent") : -1;
+	for (int done = 0, piece = 3001; extentFd >= 0 && done < EXTENT_SIZE; done += piece) {
+		if (piece > EXTENT_SIZE - done) piece = EXTENT_SIZE - done;
+		if ( writeFile(extentFd, extentData + done, piece) != piece ) extentErrors++;
+	}
+	for (int k = 0; extentFd >= 0 && k < 40; ++k) {
+		long offset = (k * 7919L) % (EXTENT_SIZE - 100);
+		if ( lseekFile(extentFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(extentFd, offset, FS_SEEK_CUR) != 0 ||
+		     readFile(extentFd, extentRead, 100) != 100 || memcmp(extentRead, extentData + offset, 100) != 0 ) extentErrors++;
+	}
+	// Overwriting the middle leaves the rest as it was, also in the next mount
+	memset(extentData + 30000, 'x', 10000);
+	if ( extentFd < 0 || lseekFile(extentFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(extentFd, 30000, FS_SEEK_CUR) != 0 ||
+	     writeFile(extentFd, extentData + 30000, 10000) != 10000 || closeFile(extentFd) != 0 || unmountFS() != 0 ) extentErrors++;
+	if ( extentErrors == 0 && (mountFS() != 0 || (extentFd = openFile("/extent")) < 0 || readFile(extentFd, extentRead, EXTENT_SIZE) != EXTENT_SIZE ||
+	     memcmp(extentRead, extentData, EXTENT_SIZE) != 0 || closeFile(extentFd) != 0) ) extentErrors++;
+	if ( extentErrors == 0 && (removeFile("/extent") != 0 || deviceFree() != extentFree || unmountFS() != 0) ) extentErrors++;
+	free(extentData);
+	free(extentRead);
+	if ( extentErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST extents ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST extents ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Two files written a block each in turn get an extent for each block, deep enough for two levels of extent blocks
+	const int DEEP_BLOCKS = 700;
+	struct stat deviceStat;
+	int deepErrors = stat(DEVICE_IMAGE, &deviceStat) != 0 || truncate(DEVICE_IMAGE, 2048L * BLOCK_SIZE) != 0;
+	if ( deepErrors == 0 && (mkFS(2048L * BLOCK_SIZE) != 0 || mountFS() != 0) ) deepErrors++;
+	long deepFree = deepErrors == 0 ? deviceFree() : -1;
+	int deepFds[2] = { -1, -1 };
+	if ( deepFree > 0 && createFile("/deep0") == 0 && createFile("/deep1") == 0 ) {
+		deepFds[0] = openFile("/deep0");
+		deepFds[1] = openFile("/deep1");
+	}
+	for (int k = 0; k < DEEP_BLOCKS && deepFds[0] >= 0 && deepFds[1] >= 0; ++k) {
+		for (int f = 0; f < 2; ++f) {
+			memset(devBlock, 0, BLOCK_SIZE);
+			sprintf(devBlock, "file %d block %d", f, k);
+			if ( writeFile(deepFds[f], devBlock, BLOCK_SIZE) != BLOCK_SIZE ) deepErrors++;
+		}
+	}
+	if ( deepFds[0] < 0 || deepFds[1] < 0 ) deepErrors++;
+	// Each block is found again from the top of the tree, in any order
+	for (int k = 0; k < DEEP_BLOCKS && deepErrors == 0; ++k) {
+		int block = (k * 389) % DEEP_BLOCKS;
+		memset(devBlock, 0, BLOCK_SIZE);
+		sprintf(devBlock, "file %d block %d", k % 2, block);
+		if ( lseekFile(deepFds[k % 2], 0, FS_SEEK_BEGIN) != 0 || lseekFile(deepFds[k % 2], (long) block * BLOCK_SIZE, FS_SEEK_CUR) != 0 ||
+		     readFile(deepFds[k % 2], devRead, BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, devBlock, BLOCK_SIZE) != 0 ) deepErrors++;
+	}
+	// A write past 2^24 blocks of the file finds no room for the blocks before it, and seeks past 2^40 bytes are refused
+	if ( deepErrors == 0 && (lseekFile(deepFds[0], 0, FS_SEEK_BEGIN) != 0 || lseekFile(deepFds[0], (1L << 24) * BLOCK_SIZE + 5, FS_SEEK_CUR) != 0 ||
+	     writeFile(deepFds[0], devBlock, 10) != -1 || lseekFile(deepFds[0], (1L << 40) + 1, FS_SEEK_BEGIN) != -1) ) deepErrors++;
+	memset(devBlock, 0, BLOCK_SIZE);
+	sprintf(devBlock, "file 0 block %d", DEEP_BLOCKS - 1);
+	if ( deepErrors == 0 && (lseekFile(deepFds[0], 0, FS_SEEK_BEGIN) != 0 || lseekFile(deepFds[0], (DEEP_BLOCKS - 1L) * BLOCK_SIZE, FS_SEEK_CUR) != 0 ||
+	     readFile(deepFds[0], devRead, 2 * BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, devBlock, BLOCK_SIZE) != 0) ) deepErrors++;
+	// Removing them gives back their blocks and the blocks of their trees
+	if ( deepErrors == 0 && (closeFile(deepFds[0]) != 0 || closeFile(deepFds[1]) != 0 || unmountFS() != 0 || mountFS() != 0) ) deepErrors++;
+	if ( deepErrors == 0 && (removeFile("/deep0") != 0 || removeFile("/deep1") != 0 || deviceFree() != deepFree || unmountFS() != 0) ) deepErrors++;
+	if ( truncate(DEVICE_IMAGE, deviceStat.st_size) != 0 ) deepErrors++;
+	if ( deepErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST deep extent tree ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST deep extent tree ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) A device of more than 2^24 blocks, sparse in the image, holds a file system and its blocks past 2^32 bytes
+	const long LARGE_BLOCKS = (1L << 24) + 4096;
+	int largeErrors = stat(DEVICE_IMAGE, &deviceStat) != 0 || truncate(DEVICE_IMAGE, LARGE_BLOCKS * BLOCK_SIZE) != 0;
+	mkfs_options largeMkfs = { 0 };
+	largeMkfs.inodes = 16;
+	if ( largeErrors == 0 && (mkFSOptions(LARGE_BLOCKS * BLOCK_SIZE, &largeMkfs) != 0 || mountFS() != 0 || createFile("/large") != 0) ) largeErrors++;
+	int largeFd = largeErrors == 0 ? openFile("/large") : -1;
+	if ( largeFd < 0 || writeFile(largeFd, vecData, sizeof(vecData)) != sizeof(vecData) || closeFile(largeFd) != 0 || unmountFS() != 0 ) largeErrors++;
+	if ( largeErrors == 0 && (mountFS() != 0 || (largeFd = openFile("/large")) < 0 || readFile(largeFd, vecRead, sizeof(vecRead)) != sizeof(vecRead) ||
+	     memcmp(vecRead, vecData, sizeof(vecData)) != 0 || closeFile(largeFd) != 0 || unmountFS() != 0) ) largeErrors++;
+	// The last blocks are reached with 64-bit offsets, and the one after them is refused
+	memset(devBlock, 'L', BLOCK_SIZE);
+	if ( largeErrors == 0 && (bopen(DEVICE_IMAGE) != 0 || bwrite(DEVICE_IMAGE, LARGE_BLOCKS - 1, devBlock) != 0 || bread(DEVICE_IMAGE, LARGE_BLOCKS - 1, devRead) != 0 ||
+	     memcmp(devRead, devBlock, BLOCK_SIZE) != 0 || bread(DEVICE_IMAGE, LARGE_BLOCKS, devRead) != -1 || bclose() != 0) ) largeErrors++;
+	if ( largeErrors == 0 && (deviceBlock(LARGE_BLOCKS - 1, devRead, 0) != 0 || memcmp(devRead, devBlock, BLOCK_SIZE) != 0) ) largeErrors++;
+	if ( truncate(DEVICE_IMAGE, deviceStat.st_size) != 0 ) largeErrors++;
+	if ( largeErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST large device ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST large device ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) The inode table has the inodes asked to mkFS, given as a count or as bytes of the device for each one
+	const long tableInodes[] = { 30, 10 };
+	int tableErrors = 0;
+	for (int t = 0; t < 2 && tableErrors == 0; ++t) {
+		mkfs_options tableMkfs = { 0 };
+		if (t == 0) tableMkfs.inodes = tableInodes[t];
+		else tableMkfs.bytesPerInode = 460 * 1024 / tableInodes[t];
+		if ( mkFSOptions(460 * 1024, &tableMkfs) != 0 || mountFS() != 0 ) { tableErrors++; break; }
+		for (int i = 0; i < tableInodes[t] && tableErrors == 0; ++i) {
+			sprintf(openName, "/table%d", i);
+			if ( createFile(openName) != 0 ) tableErrors++;
+		}
+		// The table stays full in the next mount, until a file is removed
+		if ( createFile("/tableExtra") != -2 || unmountFS() != 0 || mountFS() != 0 || createFile("/tableExtra") != -2 ) tableErrors++;
+		if ( removeFile("/table3") != 0 || createFile("/tableExtra") != 0 || unmountFS() != 0 ) tableErrors++;
+	}
+	mkfs_options tableMkfs = { 0 };
+	tableMkfs.inodes = (1L << 24) + 1;
+	if ( mkFSOptions(460 * 1024, &tableMkfs) != -1 ) tableErrors++;
+	if ( tableErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST inode table size ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST inode table size ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) Saving the metadata writes the blocks that changed alone, so a block of inodes only read is left as the device has it
+	sb syncSb;
+	tableMkfs.inodes = INODES_PER_BLOCK + 1;
+	int syncErrors = mkFSOptions(460 * 1024, &tableMkfs) != 0 || mountFS() != 0 || deviceBlock(SUPERBLOCK_BLOCK, devRead, 0) != 0;
+	memcpy(&syncSb, devRead, sizeof(sb));
+	for (int i = 0; i <= INODES_PER_BLOCK && syncErrors == 0; ++i) {
+		sprintf(openName, "/sync%d", i);
+		if ( createFile(openName) != 0 ) syncErrors++;
+	}
+	// The inode of the last file, alone in the second block, is read in the next mount and the block is marked behind it
+	sprintf(openName, "/sync%d", INODES_PER_BLOCK);
+	int syncFd = -1;
+	if ( syncErrors == 0 && (unmountFS() != 0 || mountFS() != 0 || (syncFd = openFile(openName)) < 0 || closeFile(syncFd) != 0) ) syncErrors++;
+	if ( syncErrors == 0 && deviceBlock(syncSb.inodeBlock + 1, devRead, 0) != 0 ) syncErrors++;
+	memcpy(devRead + BLOCK_SIZE - 8, "unsynced", 8);
+	if ( syncErrors == 0 && deviceBlock(syncSb.inodeBlock + 1, devRead, 1) != 0 ) syncErrors++;
+	if ( syncErrors == 0 && (syncFd = openFile("/sync0")) < 0 ) syncErrors++;
+	if ( syncFd < 0 || writeFile(syncFd, vecData, sizeof(vecData)) != sizeof(vecData) || closeFile(syncFd) != 0 || unmountFS() != 0 ) syncErrors++;
+	if ( syncErrors == 0 && (deviceBlock(syncSb.inodeBlock + 1, devRead, 0) != 0 || memcmp(devRead + BLOCK_SIZE - 8, "unsynced", 8) != 0) ) syncErrors++;
+	// The block that changed was saved
+	if ( syncErrors == 0 && (mountFS() != 0 || (syncFd = openFile("/sync0")) < 0 || readFile(syncFd, vecRead, sizeof(vecRead)) != sizeof(vecRead) ||
+	     memcmp(vecRead, vecData, sizeof(vecData)) != 0 || closeFile(syncFd) != 0 || unmountFS() != 0) ) syncErrors++;
+	if ( syncErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST incremental sync ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST incremental sync ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) What was committed before a crash is there after the replay of the journal, also when the replay itself is cut short
+	int replayErrors = mkFS(460 * 1024) != 0;
+	pid_t replayChild = replayErrors == 0 ? fork() : -1;
+	if ( replayChild == 0 ) {
+		if ( mountFS() != 0 ) _exit(1);
+		for (int i = 0; i < 3; ++i) {
+			sprintf(openName, "/replay%d", i);
+			int replayFd = createFile(openName) == 0 ? openFile(openName) : -1;
+			if ( replayFd < 0 || writeFile(replayFd, (char *) viewData + i * 1000, (i + 1) * 1000) != (i + 1) * 1000 || closeFile(replayFd) != 0 ) _exit(1);
+		}
+		// Closing a file commits the operations before it
+		if ( removeFile("/replay1") != 0 || createFile("/replay3") != 0 ) _exit(1);
+		int replayFd = openFile("/replay3");
+		if ( replayFd < 0 || closeFile(replayFd) != 0 ) _exit(1);
+		_exit(0);
+	}
+	int replayStatus = 0;
+	if ( replayChild < 0 || waitpid(replayChild, &replayStatus, 0) != replayChild || !WIFEXITED(replayStatus) || WEXITSTATUS(replayStatus) != 0 ) replayErrors++;
+	// The superblock says the file system was not unmounted, and the next mount replays without unmounting either
+	if ( replayErrors == 0 && (deviceBlock(SUPERBLOCK_BLOCK, devRead, 0) != 0 || ((sb *) devRead)->clean != 0) ) replayErrors++;
+	replayChild = replayErrors == 0 ? fork() : -1;
+	if ( replayChild == 0 ) _exit(mountFS() != 0);
+	if ( replayChild < 0 || waitpid(replayChild, &replayStatus, 0) != replayChild || !WIFEXITED(replayStatus) || WEXITSTATUS(replayStatus) != 0 ) replayErrors++;
+	if ( replayErrors == 0 && mountFS() != 0 ) replayErrors++;
+	for (int i = 0; i < 4 && replayErrors == 0; ++i) {
+		int size = i < 3 ? (i + 1) * 1000 : 0;
+		sprintf(openName, "/replay%d", i);
+		int replayFd = openFile(openName);
+		if ( i == 1 ) {
+			if ( replayFd != -1 ) replayErrors++;
+			continue;
+		}
+		if ( replayFd < 0 || readFile(replayFd, vecRead, BLOCK_SIZE * 2) != size || memcmp(vecRead, viewData + i * 1000, size) != 0 || closeFile(replayFd) != 0 ) replayErrors++;
+	}
+	if ( replayErrors == 0 && (unmountFS() != 0 || deviceBlock(SUPERBLOCK_BLOCK, devRead, 0) != 0 || ((sb *) devRead)->clean != 1) ) replayErrors++;
+	if ( replayErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST journal replay ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST journal replay ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) A data block changed behind the file system fails its checksum when read, until the file writes it again
+	for (int i = 0; i < 3; ++i) sprintf(vecData[i], "checksummed block %d", i);
+	int sumErrors = mkFS(460 * 1024) != 0 || mountFS() != 0 || createFile("/sums") != 0;
+	int sumFd = sumErrors == 0 ? openFile("/sums") : -1;
+	if ( sumFd < 0 || writeFile(sumFd, vecData, 3 * BLOCK_SIZE) != 3 * BLOCK_SIZE || closeFile(sumFd) != 0 || unmountFS() != 0 ) sumErrors++;
+	long sumBlock = sumErrors == 0 ? deviceFind(vecData[1], 0) : -1;
+	if ( sumBlock < 0 || deviceBlock(sumBlock, devRead, 0) != 0 ) sumErrors++;
+	devRead[BLOCK_SIZE / 2] ^= 1;
+	if ( sumErrors == 0 && (deviceBlock(sumBlock, devRead, 1) != 0 || mountFS() != 0 || (sumFd = openFile("/sums")) < 0) ) sumErrors++;
+	if ( sumErrors == 0 && (readFile(sumFd, devRead, BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, vecData[0], BLOCK_SIZE) != 0 || readFile(sumFd, devRead, BLOCK_SIZE) != -1) ) sumErrors++;
+	if ( sumErrors == 0 && (lseekFile(sumFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(sumFd, 2 * BLOCK_SIZE, FS_SEEK_CUR) != 0 ||
+	     readFile(sumFd, devRead, BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, vecData[2], BLOCK_SIZE) != 0) ) sumErrors++;
+	// Part of the block cannot be written over the damage, the whole block can
+	if ( sumErrors == 0 && (lseekFile(sumFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(sumFd, BLOCK_SIZE + 10, FS_SEEK_CUR) != 0 || writeFile(sumFd, "x", 1) != -1) ) sumErrors++;
+	if ( sumErrors == 0 && (lseekFile(sumFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(sumFd, BLOCK_SIZE, FS_SEEK_CUR) != 0 || writeFile(sumFd, vecData[3], BLOCK_SIZE) != BLOCK_SIZE ||
+	     lseekFile(sumFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(sumFd, BLOCK_SIZE, FS_SEEK_CUR) != 0 || readFile(sumFd, devRead, BLOCK_SIZE) != BLOCK_SIZE ||
+	     memcmp(devRead, vecData[3], BLOCK_SIZE) != 0) ) sumErrors++;
+	if ( closeFile(sumFd) != 0 || unmountFS() != 0 ) sumErrors++;
+	if ( sumErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block checksums ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST block checksums ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) CRC32C and CRC32, on the kernels the CPU has, give the values of RFC 3720 and of zlib at every length and alignment
+	unsigned char kernelData[70000];
+	for (unsigned int i = 0; i < sizeof(kernelData); ++i) kernelData[i] = (unsigned char) (i * 151 + (i >> 8));
+	unsigned char rfcData[4][32];
+	for (int i = 0; i < 32; ++i) {
+		rfcData[0][i] = 0x00;
+		rfcData[1][i] = 0xff;
+		rfcData[2][i] = i;
+		rfcData[3][i] = 31 - i;
+	}
+	int kernelErrors = CRC32C((unsigned char *) "123456789", 9) != 0xe3069283 || CRC32((unsigned char *) "123456789", 9) != 0xcbf43926;
+	if ( CRC32C(rfcData[0], 32) != 0x8a9136aa || CRC32C(rfcData[1], 32) != 0x62a8ab43 || CRC32C(rfcData[2], 32) != 0x46dd794e || CRC32C(rfcData[3], 32) != 0x113fdb5c ) kernelErrors++;
+	const unsigned int kernelLengths[] = { 511, 1024, 2048, 4099, 65549 };
+	for (int offset = 0; offset < 8; ++offset) {
+		for (unsigned int length = 0; length <= 300 + sizeof(kernelLengths) / sizeof(kernelLengths[0]); ++length) {
+			unsigned int size = length <= 300 ? length : kernelLengths[length - 301];
+			if ( CRC32C(kernelData + offset, size) != crc32cReference(kernelData + offset, size) ) kernelErrors++;
+			if ( CRC32(kernelData + offset, size) != crc32(0, kernelData + offset, size) ) kernelErrors++;
+		}
+	}
+	if ( kernelErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC32C/CRC32 kernels ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST CRC32C/CRC32 kernels ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) checkFile verifies a large file on one thread and on several, and both find a block damaged in its middle
+	const int CHECK_BLOCKS = 2000;
+	char *checkData = calloc(CHECK_BLOCKS, BLOCK_SIZE);
+	int checkErrors = checkData == NULL || stat(DEVICE_IMAGE, &deviceStat) != 0 || truncate(DEVICE_IMAGE, 4096L * BLOCK_SIZE) != 0;
+	for (int k = 0; checkData != NULL && k < CHECK_BLOCKS; ++k) sprintf(checkData + (long) k * BLOCK_SIZE, "verified block %d", k);
+	if ( checkErrors == 0 && (mkFS(4096L * BLOCK_SIZE) != 0 || mountFS() != 0 || createFile("/check") != 0) ) checkErrors++;
+	int checkFd = checkErrors == 0 ? openFile("/check") : -1;
+	if ( checkFd < 0 || writeFile(checkFd, checkData, CHECK_BLOCKS * BLOCK_SIZE - 5) != CHECK_BLOCKS * BLOCK_SIZE - 5 || closeFile(checkFd) != 0 ||
+	     includeIntegrity("/check") != 0 || unmountFS() != 0 ) checkErrors++;
+	for (int damaged = 0; damaged < 2 && checkErrors == 0; ++damaged) {
+		if ( damaged ) {
+			long checkBlock = deviceFind(checkData + 1234L * BLOCK_SIZE, 0);
+			if ( checkBlock < 0 || deviceBlock(checkBlock, devRead, 0) != 0 ) { checkErrors++; break; }
+			devRead[BLOCK_SIZE - 1] ^= 1;
+			if ( deviceBlock(checkBlock, devRead, 1) != 0 ) checkErrors++;
+		}
+		for (int threads = 1; threads <= 4; threads += 3) {
+			mount_options checkMount = { 0 };
+			checkMount.checksumThreads = threads;
+			if ( mountFSOptions(&checkMount) != 0 || checkFile("/check") != (damaged ? -1 : 0) || unmountFS() != 0 ) checkErrors++;
+		}
+	}
+	free(checkData);
+	if ( truncate(DEVICE_IMAGE, deviceStat.st_size) != 0 ) checkErrors++;
+	if ( checkErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST parallel checkFile ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST parallel checkFile ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+	// (D) A block changed together with its checksum is caught by the hash tree when read, and a changed leaf by the block above it
+	const int MERKLE_BLOCKS = 20;
+	char *merkleData = calloc(MERKLE_BLOCKS, BLOCK_SIZE);
+	uint32_t merkleLeaf[HASH_LEAF_ENTRIES] = { 0 };
+	for (int k = 0; merkleData != NULL && k < MERKLE_BLOCKS; ++k) {
+		sprintf(merkleData + (long) k * BLOCK_SIZE, "hashed block %d", k);
+		merkleLeaf[k] = CRC32C((unsigned char *) merkleData + (long) k * BLOCK_SIZE, BLOCK_SIZE);
+	}
+	int merkleErrors = merkleData == NULL || mkFS(460 * 1024) != 0 || mountFS() != 0 || createFile("/merkle") != 0;
+	int merkleFd = merkleErrors == 0 ? openFile("/merkle") : -1;
+	if ( merkleFd < 0 || writeFile(merkleFd, merkleData, MERKLE_BLOCKS * BLOCK_SIZE) != MERKLE_BLOCKS * BLOCK_SIZE || closeFile(merkleFd) != 0 ||
+	     includeIntegrity("/merkle") != 0 || unmountFS() != 0 ) merkleErrors++;
+	// The seventh block and its checksum are changed as if the device had done it, and the leaf is found past the copies in the journal
+	sb merkleSb;
+	long merkleBlock = -1, merkleLeafBlock = -1;
+	if ( merkleErrors == 0 && deviceBlock(SUPERBLOCK_BLOCK, devRead, 0) == 0 ) {
+		memcpy(&merkleSb, devRead, sizeof(sb));
+		merkleBlock = deviceFind(merkleData + 7L * BLOCK_SIZE, 0);
+		merkleLeafBlock = deviceFind((char *) merkleLeaf, merkleSb.dataBlock);
+	}
+	if ( merkleBlock < 0 || merkleLeafBlock < 0 ) merkleErrors++;
+	long merkleSum = merkleBlock - merkleSb.dataBlock;
+	memcpy(devBlock, merkleData + 7L * BLOCK_SIZE, BLOCK_SIZE);
+	devBlock[100] ^= 1;
+	merkleLeaf[7] = CRC32C((unsigned char *) devBlock, BLOCK_SIZE);
+	if ( merkleErrors == 0 && (deviceBlock(merkleBlock, devBlock, 1) != 0 || deviceBlock(merkleSb.crcBlock + merkleSum / CRCS_PER_BLOCK, devRead, 0) != 0) ) merkleErrors++;
+	((uint32_t *) devRead)[merkleSum % CRCS_PER_BLOCK] = merkleLeaf[7];
+	if ( merkleErrors == 0 && deviceBlock(merkleSb.crcBlock + merkleSum / CRCS_PER_BLOCK, devRead, 1) != 0 ) merkleErrors++;
+	if ( merkleErrors == 0 && (mountFS() != 0 || (merkleFd = openFileIntegrity("/merkle")) < 0) ) merkleErrors++;
+	if ( merkleErrors == 0 && (lseekFile(merkleFd, 0, FS_SEEK_BEGIN) != 0 || lseekFile(merkleFd, 6L * BLOCK_SIZE, FS_SEEK_CUR) != 0 ||
+	     readFile(merkleFd, devRead, BLOCK_SIZE) != BLOCK_SIZE || memcmp(devRead, merkleData + 6L * BLOCK_SIZE, BLOCK_SIZE) != 0 || readFile(merkleFd, devRead, BLOCK_SIZE) != -1) ) merkleErrors++;
+	if ( merkleErrors == 0 && (closeFile(merkleFd) != 0 || checkFile("/merkle") != -1 || unmountFS() != 0) ) merkleErrors++;
+	// With the leaf changed to match, the CRC32C of the leaf kept in the inode fails every block under it
+	if ( merkleErrors == 0 && (deviceBlock(merkleLeafBlock, (char *) merkleLeaf, 1) != 0 || mountFS() != 0 || (merkleFd = openFile("/merkle")) < 0) ) merkleErrors++;
+	if ( merkleErrors == 0 && (readFile(merkleFd, devRead, BLOCK_SIZE) != -1 || closeFile(merkleFd) != 0 || checkFile("/merkle") != -1 || unmountFS() != 0) ) merkleErrors++;
+	free(merkleData);
+	if ( merkleErrors != 0 ) {
+		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST hash tree ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);
+
+		return -1;
+	}
+	fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST hash tree ", ANSI_COLOR_GREEN, "SUCCESS\n", ANSI_COLOR_RESET);
+
+
+	// (C) The links go last, on a new file system with the file of (A) and (B) again
+	mkFS(460 * 1024);
+	mountFS();
+	createFile(FILE_NAME);
+
 	// (C) Create symbolic link and check if it exist
 	if ( createLn(FILE_NAME, "test.txt") < 0 ) {
 		fprintf(stdout, "%s%s%s%s%s", ANSI_COLOR_BLUE, "TEST createLn ", ANSI_COLOR_RED, "FAILED\n", ANSI_COLOR_RESET);